@@ -0,0 +1,661 @@
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "math/vector2d.hpp"
+#include "verlet/particle.hpp"
+#include "verlet/constraints.hpp"
+#include "verlet/composite.hpp"
+#include "verlet/objects.hpp"
+#include "verlet/verlet.hpp"
+#include "simulation/prefab.hpp"
+
+// Times the solver phases on repeatable scenes at several sizes, counts the distance relaxation
+// iterations each DistanceMode needs to undo a step, how many of them an adaptive step takes, how much the
+// scenes stretch under their own weight at several iteration counts and what grabbing a particle costs.
+// usage: verlet-bench [--format=csv|json] [--sizes=1000,10000,100000] [--repeat=N] [--threads=N]
+//                     [--simd=scalar|sse|avx2] [--help]
+
+using namespace simulation;
+using namespace verlet;
+
+namespace
+{
+    const float WORLD_SIZE = 100000;
+    const int WARMUP_STEPS = 10;
+    // convergence runs start from the scene as built, at rest, with every particle moved by up to STRETCH
+    // of the mean rest length. MAX_CONVERGENCE_ITERATIONS passes from there bring the rms distance residual
+    // down to the floor of the mode under test, and a run converges once it has removed all but
+    // CONVERGED_SHARE of the residual above that floor. Runs that do not get there report NOT_CONVERGED.
+    const float STRETCH = 0.1f;
+    const int MAX_CONVERGENCE_ITERATIONS = 2000;
+    const double CONVERGED_SHARE = 0.01;
+    const int NOT_CONVERGED = -1;
+    // strain runs take STRAIN_STEPS steps from the scene as built at each of STRAIN_ITERATIONS per step
+    const int STRAIN_STEPS = 15;
+    const int STRAIN_ITERATIONS[] = {4, 16, 64};
+    const int STRAIN_RUNS = sizeof(STRAIN_ITERATIONS) / sizeof(STRAIN_ITERATIONS[0]);
+    // compliance of every constraint of the scenes, only read by the xpbd mode
+    const float BENCH_COMPLIANCE = 0.001f;
+    // adaptive steps run the exact mode until the rms distance residual is within ADAPTIVE_TOLERANCE of the
+    // rest lengths
+    const float ADAPTIVE_TOLERANCE = 0.005f;
+    const int ADAPTIVE_MIN_ITERATIONS = 2;
+    // radius of the demo's mouse grab, finer than the collision grid of these scenes
+    const float GRAB_DISTANCE = 8;
+    // indexed by kernels::SimdLevel
+    const char* const SIMD_NAMES[] = {"scalar", "sse", "avx2"};
+
+    const char USAGE[] =
+        "usage: verlet-bench [--format=csv|json] [--sizes=1000,10000,100000] [--repeat=N] [--threads=N]\n"
+        "                    [--simd=scalar|sse|avx2] [--help]\n"
+        "  --format   output format, csv by default\n"
+        "  --sizes    comma separated particle counts of each scene, 1000,10000,100000 by default\n"
+        "  --repeat   runs of each timed phase, 20 by default\n"
+        "  --threads  solver threads, 1 by default\n"
+        "  --simd     kernel level, the best one the CPU supports by default\n"
+        "  --help     prints this and exits\n";
+
+    struct Options
+    {
+        bool help;
+        std::string format;
+        std::vector<int> sizes;
+        int repeat;
+        int threads;
+        std::string simd;
+    };
+
+    struct Result
+    {
+        std::string scene;
+        std::string simd;
+        int particles;
+        int distance_constraints;
+        int angular_constraints;
+        int pin_constraints;
+        double integrate;
+        double distance;
+        double exact_distance;
+        double angular;
+        double pin;
+        double bounds;
+        double step;
+        int approximate_iterations;
+        int exact_iterations;
+        // exact mode steps at the full iteration count, what adaptive steps compare with
+        double exact_step;
+        double adaptive_step;
+        double adaptive_iterations;
+        double adaptive_max_residual;
+        double adaptive_rms_residual;
+        double approximate_strain[STRAIN_RUNS];
+        double xpbd_strain[STRAIN_RUNS];
+        double grab_build;
+        double grab;
+    };
+
+    typedef bool (*SceneBuilder)(ObjectPool<float>* object_pool, int particles);
+
+    // one square cloth, pinned every 5th particle along the top
+    bool BuildCloth(ObjectPool<float>* object_pool, int particles)
+    {
+        int segments = (int) std::sqrt((float) particles);
+        math::Vector2d<float> top_left(100, 100);
+        return Cloth<float>(top_left, segments * 10, segments * 10, segments, 5, 0.9f, object_pool,
+            BENCH_COMPLIANCE) != nullptr;
+    }
+
+    // a grid of 30 segment tires, the first built and the rest stamped from it
+    bool BuildTires(ObjectPool<float>* object_pool, int particles)
+    {
+        int tires = particles / 31;
+        int columns = (int) std::sqrt((float) tires) + 1;
+        std::vector<PrefabInstance<float> > instances;
+        for (int t = 0; t < tires; ++t)
+        {
+            math::Vector2d<float> center(100 + (t % columns) * 100, 100 + (t / columns) * 100);
+            instances.push_back(PrefabInstance<float>(center, 0));
+        }
+        if (tires == 0)
+        {
+            return true;
+        }
+
+        Composite<float>* tire = Tire<float>(instances[0].position, 30, 30, 1, 1, object_pool, BENCH_COMPLIANCE);
+        Prefab<float> prefab;
+        return tire != nullptr && prefab.Capture(*object_pool, *tire, instances[0].position)
+            && (tires == 1 || prefab.Spawn(object_pool, &instances[1], tires - 1) != nullptr);
+    }
+
+    // 1000 particle ropes pinned at one end, with an angular constraint at every joint
+    bool BuildRopes(ObjectPool<float>* object_pool, int particles)
+    {
+        const int rope_length = 1000;
+        std::vector<math::Vector2d<float> > points;
+        for (int p = 0; p < rope_length; ++p)
+        {
+            points.push_back(math::Vector2d<float>(p * 5, 0));
+        }
+        std::vector<int> pins = {0};
+
+        int ropes = (particles + rope_length - 1) / rope_length;
+        for (int r = 0; r < ropes; ++r)
+        {
+            math::Vector2d<float> offset(100, 100 + r * 20);
+            Composite<float>* rope = LineSegments<float>(points, pins, offset, 0.5f, object_pool, BENCH_COMPLIANCE);
+            AngularConstraint<float>* angular = object_pool->AllocateAngularConstraints(rope_length - 2);
+            if (rope == nullptr || angular == nullptr)
+            {
+                return false;
+            }
+            int first = rope->particles().first;
+            for (int p = 0; p < rope_length - 2; ++p)
+            {
+                angular[p] = AngularConstraint<float>(object_pool->particles, first + p, first + p + 1, first + p + 2,
+                    0.1f, BENCH_COMPLIANCE);
+            }
+            rope->SetConstraints(ANGULAR_CONSTRAINT, IndexRange(object_pool->Index(angular), rope_length - 2));
+        }
+        return true;
+    }
+
+    // copies of the demo scene: rope, pentagon, tire and cloth
+    bool BuildMix(ObjectPool<float>* object_pool, int particles)
+    {
+        int copies = (particles + 451) / 452;
+        int columns = (int) std::sqrt((float) copies) + 1;
+        for (int c = 0; c < copies; ++c)
+        {
+            math::Vector2d<float> origin((c % columns) * 1000, (c / columns) * 700);
+
+            std::vector<math::Vector2d<float> > rope_points;
+            for (int p = 0; p < 16; ++p)
+            {
+                rope_points.push_back(math::Vector2d<float>(p * 20, 0));
+            }
+            std::vector<int> pins = {0};
+            math::Vector2d<float> rope_offset = origin + math::Vector2d<float>(400, 30);
+
+            std::vector<math::Vector2d<float> > box_points = {
+                math::Vector2d<float>(40,0), math::Vector2d<float>(110,0), math::Vector2d<float>(150,75),
+                math::Vector2d<float>(75,150), math::Vector2d<float>(0,75)
+            };
+            std::vector<std::pair<int, int> > box_pairs = {
+                {0,1}, {1,2}, {2,3}, {3,4}, {0,4}, {0,2}, {0,3}, {1,3}, {1,4}, {2,4}
+            };
+            math::Vector2d<float> box_offset = origin + math::Vector2d<float>(100, 200);
+            math::Vector2d<float> tire_center = origin + math::Vector2d<float>(500, 200);
+            math::Vector2d<float> cloth_top_left = origin + math::Vector2d<float>(700, 50);
+
+            if (LineSegments<float>(rope_points, pins, rope_offset, 0.2f, object_pool, BENCH_COMPLIANCE) == nullptr
+                || Polygon<float>(box_points, box_pairs, box_offset, 1, object_pool, BENCH_COMPLIANCE) == nullptr
+                || Tire<float>(tire_center, 100, 30, 1, 1, object_pool, BENCH_COMPLIANCE) == nullptr
+                || Cloth<float>(cloth_top_left, 300, 350, 20, 5, 0.9f, object_pool, BENCH_COMPLIANCE) == nullptr)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    struct SavedState
+    {
+        std::vector<float> x, y, last_x, last_y;
+
+        void Save(const ObjectPool<float>& object_pool)
+        {
+            int count = object_pool.particle_count;
+            const ParticleArrays<float>& particles = object_pool.particles;
+            x.assign(particles.x, particles.x + count);
+            y.assign(particles.y, particles.y + count);
+            last_x.assign(particles.last_x, particles.last_x + count);
+            last_y.assign(particles.last_y, particles.last_y + count);
+        }
+
+        void Restore(const ObjectPool<float>& object_pool) const
+        {
+            const ParticleArrays<float>& particles = object_pool.particles;
+            std::memcpy(particles.x, x.data(), x.size() * sizeof(float));
+            std::memcpy(particles.y, y.data(), y.size() * sizeof(float));
+            std::memcpy(particles.last_x, last_x.data(), last_x.size() * sizeof(float));
+            std::memcpy(particles.last_y, last_y.data(), last_y.size() * sizeof(float));
+        }
+    };
+
+    // ns per element of phase, run repeat times from the same saved state; 0 when there is nothing to time
+    template <class F>
+    double Time(const SavedState& state, const ObjectPool<float>& object_pool, int repeat, int elements, F phase)
+    {
+        if (elements == 0)
+        {
+            return 0;
+        }
+        state.Restore(object_pool);
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repeat; ++r)
+        {
+            phase();
+        }
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count() / ((double) repeat * elements);
+    }
+
+    // Moves every particle by up to share of distance along each axis, the same way on every run, which
+    // stretches or squeezes each constraint on it by about that share of its rest length
+    void Stretch(const ObjectPool<float>& object_pool, float share, float distance)
+    {
+        const ParticleArrays<float>& particles = object_pool.particles;
+        unsigned random = 12345;
+        for (int p = 0; p < object_pool.particle_count; ++p)
+        {
+            random = random * 1664525u + 1013904223u;
+            particles.x[p] += share * distance * ((random >> 8) / 8388608.0f - 1);
+            random = random * 1664525u + 1013904223u;
+            particles.y[p] += share * distance * ((random >> 8) / 8388608.0f - 1);
+        }
+    }
+
+    // One relaxation pass with every phase Step runs, so pins hold and collisions push as they do there
+    void RelaxPass(Verlet<float>& solver, float coeff)
+    {
+        solver.RelaxDistanceConstraints(coeff);
+        solver.RelaxAngularConstraints(coeff);
+        solver.RelaxCollisions();
+        solver.RelaxPinConstraints(coeff);
+    }
+
+    // Relaxation passes a mode needs to pull a stretched scene to the residual it settles at itself,
+    // NOT_CONVERGED if it does not get there. Each mode is measured against its own floor, so one that settles
+    // short of the rest lengths is not held to them. The stretch is local, a step leaves that kind of error;
+    // stretching the whole scene would instead time how slowly a long rope or a large cloth contracts.
+    int IterationsToConverge(const SavedState& built, ObjectPool<float>& object_pool, Verlet<float>& solver,
+        DistanceMode mode)
+    {
+        double rest_length = 0;
+        const DistanceConstraint<float>* constraints = object_pool.distance_constraints;
+        for (int c = 0; c < object_pool.distance_constraints_count; ++c)
+        {
+            rest_length += constraints[c].distance;
+        }
+        rest_length /= std::max(1, object_pool.distance_constraints_count);
+
+        built.Restore(object_pool);
+        solver.SetDistanceMode(mode);
+        solver.PrepareBatches();
+        Stretch(object_pool, STRETCH, (float) rest_length);
+        solver.PrepareCollisions();
+        SavedState stretched;
+        stretched.Save(object_pool);
+
+        // a pass reports the residual it started from, so the first one measures the stretch
+        const float coeff = 1.0f / solver.iterations;
+        RelaxPass(solver, coeff);
+        const double start = solver.residual.rms();
+        double floor = start;
+        for (int i = 1; i < MAX_CONVERGENCE_ITERATIONS; ++i)
+        {
+            RelaxPass(solver, coeff);
+            floor = std::min(floor, (double) solver.residual.rms());
+        }
+        const double target = floor + CONVERGED_SHARE * (start - floor);
+
+        stretched.Restore(object_pool);
+        int iterations = 0;
+        for (;;)
+        {
+            RelaxPass(solver, coeff);
+            if (solver.residual.rms() <= target)
+            {
+                break;
+            }
+            if (++iterations == MAX_CONVERGENCE_ITERATIONS)
+            {
+                iterations = NOT_CONVERGED;
+                break;
+            }
+        }
+        solver.SetDistanceMode(DistanceMode::Approximate);
+        return iterations;
+    }
+
+    // Mean strain |d - l| / l of the distance constraints after STRAIN_STEPS steps from the scene as built, in
+    // mode at the given iterations per step. The approximate mode gets softer with fewer iterations; xpbd only
+    // stretches as far as its compliance lets it, whatever the iteration count.
+    double StrainAfterSteps(const SavedState& built, ObjectPool<float>& object_pool, Verlet<float>& solver,
+        DistanceMode mode, int iterations)
+    {
+        int saved_iterations = solver.iterations;
+        built.Restore(object_pool);
+        solver.SetDistanceMode(mode);
+        solver.SetIterations(iterations);
+        for (int s = 0; s < STRAIN_STEPS; ++s)
+        {
+            solver.Step(solver.time_step);
+        }
+
+        double strain = 0;
+        const ParticleArrays<float>& particles = object_pool.particles;
+        const DistanceConstraint<float>* constraints = object_pool.distance_constraints;
+        for (int c = 0; c < object_pool.distance_constraints_count; ++c)
+        {
+            double dx = particles.x[constraints[c].particle1] - particles.x[constraints[c].particle2];
+            double dy = particles.y[constraints[c].particle1] - particles.y[constraints[c].particle2];
+            strain += std::max(0.0, std::sqrt(dx * dx + dy * dy) - constraints[c].distance) / constraints[c].distance;
+        }
+        solver.SetIterations(saved_iterations);
+        solver.SetDistanceMode(DistanceMode::Approximate);
+        return strain / std::max(1, object_pool.distance_constraints_count);
+    }
+
+    // us per grab of the particle nearest to a point next to one of the scene, the way World::Grab finds it
+    // when the collision grid is too coarse. With rebuild each grab builds the pick grid first, as the first
+    // grab after a step does; without it they all use one grid, as the later grabs of the same step do.
+    double TimeGrab(const ObjectPool<float>& object_pool, int repeat, bool rebuild)
+    {
+        const ParticleArrays<float>& particles = object_pool.particles;
+        const int count = object_pool.particle_count;
+        if (count == 0)
+        {
+            return 0;
+        }
+        SpatialGrid<float> pick_grid;
+        pick_grid.Build(particles, count, GRAB_DISTANCE);
+        volatile int nearest = -1;
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repeat; ++r)
+        {
+            if (rebuild)
+            {
+                pick_grid.Build(particles, count, GRAB_DISTANCE);
+            }
+            int target = (int) ((r * 7919LL) % count);
+            nearest = pick_grid.FindNearest(particles, particles.x[target] + 1, particles.y[target], GRAB_DISTANCE);
+        }
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+        (void) nearest;
+        return elapsed.count() / repeat;
+    }
+
+    bool Run(const std::string& name, SceneBuilder build, int particles, const Options& options, Result& result)
+    {
+        ObjectPool<float> object_pool(particles + 1000, particles / 2 + 100, particles * 4 + 1000,
+            particles + 1000, particles + 100);
+        Verlet<float> solver(WORLD_SIZE, WORLD_SIZE, &object_pool);
+        solver.SetThreadCount(options.threads);
+        // every phase is timed on the full scene, the repeated steps would otherwise put it to sleep
+        solver.SetSleepVelocity(0);
+        for (int level = 0; level < 3; ++level)
+        {
+            if (options.simd == SIMD_NAMES[level])
+            {
+                solver.SetSimdLevel((kernels::SimdLevel) level);
+            }
+        }
+
+        if (!build(&object_pool, particles))
+        {
+            std::cerr << name << ": object pool too small for " << particles << " particles" << std::endl;
+            return false;
+        }
+        // the scene as built, at rest, is where the convergence runs start from
+        SavedState built;
+        built.Save(object_pool);
+        for (int s = 0; s < WARMUP_STEPS; ++s)
+        {
+            solver.Step(solver.time_step);
+        }
+        solver.PrepareBatches();
+
+        SavedState state;
+        state.Save(object_pool);
+
+        const float coeff = 1.0f / solver.iterations;
+        const int repeat = options.repeat;
+        result.scene = name;
+        result.simd = SIMD_NAMES[(int) solver.simd_level];
+        result.particles = object_pool.particle_count;
+        result.distance_constraints = object_pool.distance_constraints_count;
+        result.angular_constraints = object_pool.angular_constraints_count;
+        result.pin_constraints = object_pool.pin_constraints_count;
+
+        result.integrate = Time(state, object_pool, repeat, result.particles,
+            [&]() { solver.Integrate(solver.time_step); });
+        result.distance = Time(state, object_pool, repeat, result.distance_constraints,
+            [&]() { solver.RelaxDistanceConstraints(coeff); });
+        solver.SetDistanceMode(DistanceMode::Exact);
+        result.exact_distance = Time(state, object_pool, repeat, result.distance_constraints,
+            [&]() { solver.RelaxDistanceConstraints(coeff); });
+        solver.SetDistanceMode(DistanceMode::Approximate);
+        result.angular = Time(state, object_pool, repeat, result.angular_constraints,
+            [&]() { solver.RelaxAngularConstraints(coeff); });
+        result.pin = Time(state, object_pool, repeat, result.pin_constraints,
+            [&]() { solver.RelaxPinConstraints(coeff); });
+        result.bounds = Time(state, object_pool, repeat, result.particles, [&]() { solver.RestrictToBounds(); });
+        result.step = Time(state, object_pool, repeat, result.particles,
+            [&]() { solver.Step(solver.time_step); });
+
+        result.approximate_iterations = IterationsToConverge(built, object_pool, solver, DistanceMode::Approximate);
+        result.exact_iterations = IterationsToConverge(built, object_pool, solver, DistanceMode::Exact);
+
+        solver.SetDistanceMode(DistanceMode::Exact);
+        result.exact_step = Time(state, object_pool, repeat, result.particles,
+            [&]() { solver.Step(solver.time_step); });
+        solver.SetTolerance(ADAPTIVE_TOLERANCE, ADAPTIVE_MIN_ITERATIONS);
+        int iterations_used = 0;
+        result.adaptive_step = Time(state, object_pool, repeat, result.particles, [&]() {
+            solver.Step(solver.time_step);
+            iterations_used += solver.iterations_used;
+        });
+        result.adaptive_iterations = (double) iterations_used / repeat;
+        result.adaptive_max_residual = solver.residual.max;
+        result.adaptive_rms_residual = solver.residual.rms();
+        solver.SetTolerance(0, 1);
+        solver.SetDistanceMode(DistanceMode::Approximate);
+
+        for (int run = 0; run < STRAIN_RUNS; ++run)
+        {
+            result.approximate_strain[run] = StrainAfterSteps(built, object_pool, solver, DistanceMode::Approximate,
+                STRAIN_ITERATIONS[run]);
+            result.xpbd_strain[run] = StrainAfterSteps(built, object_pool, solver, DistanceMode::Xpbd,
+                STRAIN_ITERATIONS[run]);
+        }
+
+        state.Restore(object_pool);
+        result.grab_build = TimeGrab(object_pool, repeat, true);
+        result.grab = TimeGrab(object_pool, repeat, false);
+        return true;
+    }
+
+    void PrintCsv(const std::vector<Result>& results, const Options& options)
+    {
+        std::cout << "scene,particles,distance_constraints,angular_constraints,pin_constraints,threads,simd,"
+            << "integrate_ns_per_particle,distance_ns_per_constraint,exact_distance_ns_per_constraint,"
+            << "angular_ns_per_constraint,pin_ns_per_constraint,bounds_ns_per_particle,step_ns_per_particle,"
+            << "approximate_iterations,exact_iterations,exact_step_ns_per_particle,adaptive_step_ns_per_particle,"
+            << "adaptive_iterations,"
+            << "adaptive_max_residual,adaptive_rms_residual,";
+        for (int run = 0; run < STRAIN_RUNS; ++run)
+        {
+            std::cout << "approximate_strain_" << STRAIN_ITERATIONS[run] << ",";
+        }
+        for (int run = 0; run < STRAIN_RUNS; ++run)
+        {
+            std::cout << "xpbd_strain_" << STRAIN_ITERATIONS[run] << ",";
+        }
+        std::cout << "grab_build_us,grab_us" << std::endl;
+        for (auto it = results.begin(); it != results.end(); ++it)
+        {
+            std::cout << it->scene << "," << it->particles << "," << it->distance_constraints << ","
+                << it->angular_constraints << "," << it->pin_constraints << "," << options.threads << ","
+                << it->simd << "," << it->integrate << "," << it->distance << "," << it->exact_distance << ","
+                << it->angular << "," << it->pin << "," << it->bounds << "," << it->step << ","
+                << it->approximate_iterations << "," << it->exact_iterations << "," << it->exact_step << ","
+                << it->adaptive_step << ","
+                << it->adaptive_iterations << "," << it->adaptive_max_residual << ","
+                << it->adaptive_rms_residual << ",";
+            for (int run = 0; run < STRAIN_RUNS; ++run)
+            {
+                std::cout << it->approximate_strain[run] << ",";
+            }
+            for (int run = 0; run < STRAIN_RUNS; ++run)
+            {
+                std::cout << it->xpbd_strain[run] << ",";
+            }
+            std::cout << it->grab_build << "," << it->grab << std::endl;
+        }
+    }
+
+    void PrintJson(const std::vector<Result>& results, const Options& options)
+    {
+        std::cout << "[" << std::endl;
+        for (auto it = results.begin(); it != results.end(); ++it)
+        {
+            std::cout << "  {\"scene\": \"" << it->scene << "\", \"particles\": " << it->particles
+                << ", \"distance_constraints\": " << it->distance_constraints
+                << ", \"angular_constraints\": " << it->angular_constraints
+                << ", \"pin_constraints\": " << it->pin_constraints
+                << ", \"threads\": " << options.threads << ", \"simd\": \"" << it->simd << "\""
+                << ", \"integrate_ns_per_particle\": " << it->integrate
+                << ", \"distance_ns_per_constraint\": " << it->distance
+                << ", \"exact_distance_ns_per_constraint\": " << it->exact_distance
+                << ", \"angular_ns_per_constraint\": " << it->angular
+                << ", \"pin_ns_per_constraint\": " << it->pin
+                << ", \"bounds_ns_per_particle\": " << it->bounds
+                << ", \"step_ns_per_particle\": " << it->step
+                << ", \"approximate_iterations\": " << it->approximate_iterations
+                << ", \"exact_iterations\": " << it->exact_iterations
+                << ", \"exact_step_ns_per_particle\": " << it->exact_step
+                << ", \"adaptive_step_ns_per_particle\": " << it->adaptive_step
+                << ", \"adaptive_iterations\": " << it->adaptive_iterations
+                << ", \"adaptive_max_residual\": " << it->adaptive_max_residual
+                << ", \"adaptive_rms_residual\": " << it->adaptive_rms_residual;
+            for (int run = 0; run < STRAIN_RUNS; ++run)
+            {
+                std::cout << ", \"approximate_strain_" << STRAIN_ITERATIONS[run] << "\": "
+                    << it->approximate_strain[run];
+            }
+            for (int run = 0; run < STRAIN_RUNS; ++run)
+            {
+                std::cout << ", \"xpbd_strain_" << STRAIN_ITERATIONS[run] << "\": " << it->xpbd_strain[run];
+            }
+            std::cout << ", \"grab_build_us\": " << it->grab_build
+                << ", \"grab_us\": " << it->grab << "}"
+                << ((it + 1 != results.end()) ? "," : "") << std::endl;
+        }
+        std::cout << "]" << std::endl;
+    }
+
+    bool ParseOptions(int argc, char* argv[], Options& options)
+    {
+        options.help = false;
+        options.format = "csv";
+        options.sizes = {1000, 10000, 100000};
+        options.repeat = 20;
+        options.threads = 1;
+        options.simd = "auto";
+
+        for (int a = 1; a < argc; ++a)
+        {
+            std::string arg = argv[a];
+            std::string::size_type equals = arg.find('=');
+            std::string key = arg.substr(0, equals);
+            std::string value = (equals == std::string::npos) ? "" : arg.substr(equals + 1);
+
+            if (key == "--help")
+            {
+                options.help = true;
+            }
+            else if (key == "--format" && (value == "csv" || value == "json"))
+            {
+                options.format = value;
+            }
+            else if (key == "--sizes")
+            {
+                options.sizes.clear();
+                for (std::string::size_type start = 0; start < value.size();)
+                {
+                    std::string::size_type comma = value.find(',', start);
+                    if (comma == std::string::npos)
+                    {
+                        comma = value.size();
+                    }
+                    options.sizes.push_back(atoi(value.substr(start, comma - start).c_str()));
+                    start = comma + 1;
+                }
+            }
+            else if (key == "--repeat")
+            {
+                options.repeat = std::max(1, atoi(value.c_str()));
+            }
+            else if (key == "--threads")
+            {
+                options.threads = std::max(1, atoi(value.c_str()));
+            }
+            else if (key == "--simd" && (value == "scalar" || value == "sse" || value == "avx2"))
+            {
+                // the solver would quietly fall back to a lower level, which is not the one asked to be timed
+                int level = (value == "scalar") ? 0 : (value == "sse") ? 1 : 2;
+                if (level > (int) kernels::DetectSimdLevel())
+                {
+                    std::cerr << "this CPU does not support --simd=" << value << std::endl;
+                    return false;
+                }
+                options.simd = value;
+            }
+            else
+            {
+                std::cerr << "unknown option " << arg << std::endl << USAGE;
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        return 1;
+    }
+    if (options.help)
+    {
+        std::cout << USAGE;
+        return 0;
+    }
+
+    const char* names[] = {"cloth", "tires", "ropes", "mix"};
+    SceneBuilder builders[] = {&BuildCloth, &BuildTires, &BuildRopes, &BuildMix};
+
+    std::vector<Result> results;
+    for (int scene = 0; scene < 4; ++scene)
+    {
+        for (auto size = options.sizes.begin(); size != options.sizes.end(); ++size)
+        {
+            Result result;
+            if (!Run(names[scene], builders[scene], *size, options, result))
+            {
+                return 1;
+            }
+            results.push_back(result);
+        }
+    }
+
+    if (options.format == "json")
+    {
+        PrintJson(results, options);
+    }
+    else
+    {
+        PrintCsv(results, options);
+    }
+    return 0;
+}
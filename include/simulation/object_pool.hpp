@@ -2,41 +2,148 @@
 #ifndef ____object_pool__
 #define ____object_pool__
 
+#include <vector>
+
 #include "verlet/particle.hpp"
 #include "verlet/constraints.hpp"
 #include "verlet/composite.hpp"
+#include "simulation/reserved_array.hpp"
 
 namespace simulation
 {
 	using namespace verlet;
 
-	template <class T>
-	class ObjectPool
+	// Stable reference to a composite. Destroying a composite moves the others in the pool, a handle keeps
+	// finding its composite and goes stale once that composite is destroyed.
+	struct CompositeHandle
+	{
+		int slot;
+		int generation;
+	};
+
+	// Packed, vtable free storage and count of one constraint kind
+	template <class Kind>
+	struct ConstraintArray
 	{
+		ReservedArray<Kind> storage;
+		int count;
+
+		explicit ConstraintArray(int capacity) : storage(capacity), count(0)
+		{
+		}
+	};
+
+
+	// Particles, constraints and composites of a scene. Every constraint kind lives in its own array: the
+	// built in pin, distance and angular constraints, then the kinds given as Extra, each with room for
+	// max_extra_constraints elements. Kind ids follow that order.
+	template <class T, class... Extra>
+	class ObjectPool : private ConstraintArray<PinConstraint<T> >, private ConstraintArray<DistanceConstraint<T> >,
+		private ConstraintArray<AngularConstraint<T> >, private ConstraintArray<Extra>...
+	{
+		static const int KIND_COUNT = 3 + sizeof...(Extra);
+		static_assert(KIND_COUNT <= MAX_CONSTRAINT_KINDS, "ObjectPool supports up to MAX_CONSTRAINT_KINDS kinds");
+
 		const int MAX_PARTICLES;
-		const int MAX_PIN_CONSTRAINTS;
-		const int MAX_DISTANCE_CONSTRAINTS;
-		const int MAX_ANGULAR_CONSTRAINTS;
 		const int MAX_COMPOSITES;
 
+		// address space for the maximum counts is reserved up front, memory is committed and elements are
+		// constructed as the counts grow
+		ReservedArray<T> _x;
+		ReservedArray<T> _y;
+		ReservedArray<T> _last_x;
+		ReservedArray<T> _last_y;
+		ReservedArray<T> _radius;
+		ReservedArray<T> _inverse_mass;
+		ReservedArray<Composite<T> > _composite_storage;
+		ReservedArray<int> _composite_slot_storage;
+
 		int _particle_count;
-		Particle<T>* _particles;
+		ParticleArrays<T> _particles;
 
-		int _pin_constraints_count;
 		PinConstraint<T>* _pin_constraints;
-
-		int _distance_constraints_count;
 		DistanceConstraint<T>* _distance_constraints;
-
-		int _angular_constraints_count;
 		AngularConstraint<T>* _angular_constraints;
 
 		int _composite_count;
 		Composite<T>* _composites;
 
+		// handle slot of each composite; composite index (-1 when free) and generation of each slot
+		int* _composite_slots;
+		std::vector<int> _slot_composites;
+		std::vector<int> _slot_generations;
+		std::vector<int> _free_slots;
+
+		// old to new index maps of the last destruction, kept so that tearing down a scene composite by
+		// composite does not allocate them again each time
+		std::vector<int> _particle_remap;
+		std::vector<int> _constraint_remaps[KIND_COUNT];
+		std::vector<int> _composite_remap;
+
+		int _topology_version;
+
+		template <class Kind>
+		ConstraintArray<Kind>& Array()
+		{
+			return *this;
+		}
+
+		template <class Kind>
+		const ConstraintArray<Kind>& Array() const
+		{
+			return *this;
+		}
+
+		// Calls visitor(array) with the ConstraintArray of every kind, in kind id order
+		template <class V>
+		void ForEachKind(V& visitor)
+		{
+			visitor(Array<PinConstraint<T> >());
+			visitor(Array<DistanceConstraint<T> >());
+			visitor(Array<AngularConstraint<T> >());
+			int expand[] = {0, (visitor(Array<Extra>()), 0)...};
+			(void) expand;
+		}
+
+		// Drops the constraints on removed particles, keeping the order of the rest, and fills in the old to
+		// new index map of each kind
+		struct CompactConstraints
+		{
+			const std::vector<int>& particle_remap;
+			std::vector<int>* remaps;
+
+			template <class Kind>
+			void operator()(ConstraintArray<Kind>& array) const
+			{
+				std::vector<int>& remap = remaps[KindId<Kind>()];
+				remap.assign(array.count, -1);
+				Kind* constraints = array.storage.data();
+				int kept = 0;
+				for (int c = 0; c < array.count; ++c)
+				{
+					bool survives = true;
+					constraints[c].ForEachParticle([&](int particle) {
+						survives = survives && (particle_remap[particle] >= 0);
+					});
+					if (!survives)
+					{
+						continue;
+					}
+					if (kept != c)
+					{
+						constraints[kept] = constraints[c];
+					}
+					constraints[kept].Reindex(particle_remap);
+					remap[c] = kept++;
+				}
+				array.count = kept;
+				array.storage.Resize(kept);
+			}
+		};
+
 	public:
 
-		Particle<T>* const & particles;
+		const ParticleArrays<T>& particles;
 		const int& particle_count;
 
 		PinConstraint<T>* const & pin_constraints;
@@ -51,96 +158,320 @@ namespace simulation
 		Composite<T>* const & composites;
 		const int& composite_count;
 
+		// Bumped on every allocation and destruction, so derived data (e.g. constraint batches) knows when
+		// to rebuild
+		const int& topology_version;
+
 
 		ObjectPool(int max_particles, int max_pin_constraints, int max_distance_constraints, 
-			int max_angular_constraints, int max_composites)
-			: MAX_PARTICLES(max_particles), MAX_PIN_CONSTRAINTS(max_pin_constraints),
-			MAX_DISTANCE_CONSTRAINTS(max_distance_constraints), MAX_ANGULAR_CONSTRAINTS(max_angular_constraints),
-			MAX_COMPOSITES(max_composites), particles(_particles), particle_count(_particle_count),
-			pin_constraints(_pin_constraints), pin_constraints_count(_pin_constraints_count),
-			distance_constraints(_distance_constraints), distance_constraints_count(_distance_constraints_count),
-			angular_constraints(_angular_constraints), angular_constraints_count(_angular_constraints_count),
-			composites(_composites), composite_count(_composite_count)
+			int max_angular_constraints, int max_composites, int max_extra_constraints = 0)
+			: ConstraintArray<PinConstraint<T> >(max_pin_constraints),
+			ConstraintArray<DistanceConstraint<T> >(max_distance_constraints),
+			ConstraintArray<AngularConstraint<T> >(max_angular_constraints),
+			ConstraintArray<Extra>(max_extra_constraints)..., MAX_PARTICLES(max_particles),
+			MAX_COMPOSITES(max_composites), _x(max_particles), _y(max_particles), _last_x(max_particles),
+			_last_y(max_particles), _radius(max_particles), _inverse_mass(max_particles),
+			_composite_storage(max_composites), _composite_slot_storage(max_composites), particles(_particles), particle_count(_particle_count),
+			pin_constraints(_pin_constraints), pin_constraints_count(Array<PinConstraint<T> >().count),
+			distance_constraints(_distance_constraints),
+			distance_constraints_count(Array<DistanceConstraint<T> >().count),
+			angular_constraints(_angular_constraints), angular_constraints_count(Array<AngularConstraint<T> >().count),
+			composites(_composites), composite_count(_composite_count), topology_version(_topology_version)
 		{
 			_particle_count = 0;
-			_pin_constraints_count = 0;
-			_distance_constraints_count = 0;
-			_angular_constraints_count = 0;
 			_composite_count = 0;
+			_topology_version = 0;
 
-			_particles = new Particle<T>[MAX_PARTICLES];
-			_pin_constraints = new PinConstraint<T>[MAX_PIN_CONSTRAINTS];
-			_distance_constraints = new DistanceConstraint<T>[MAX_DISTANCE_CONSTRAINTS];
-			_angular_constraints = new AngularConstraint<T>[MAX_ANGULAR_CONSTRAINTS];
-			_composites = new Composite<T>[MAX_COMPOSITES];
+			// the reserved ranges never move, so these pointers stay valid as the pool grows
+			_particles.x = _x.data();
+			_particles.y = _y.data();
+			_particles.last_x = _last_x.data();
+			_particles.last_y = _last_y.data();
+			_particles.radius = _radius.data();
+			_particles.inverse_mass = _inverse_mass.data();
+			_pin_constraints = Constraints<PinConstraint<T> >();
+			_distance_constraints = Constraints<DistanceConstraint<T> >();
+			_angular_constraints = Constraints<AngularConstraint<T> >();
+			_composites = _composite_storage.data();
+			_composite_slots = _composite_slot_storage.data();
 		}
 
-		~ObjectPool() {
-			delete [] _composites;
-			delete [] _angular_constraints;
-			delete [] _distance_constraints;
-			delete [] _pin_constraints;
-			delete [] _particles;
-		}
+		ObjectPool(const ObjectPool&) = delete;
+		ObjectPool& operator=(const ObjectPool&) = delete;
 
 		bool CanAllocate(int particles, int pin_constraints, int distance_constraints, int angular_constraints,
 			int composites)
 		{
 			return (_particle_count + particles <= MAX_PARTICLES)
-				&& (_pin_constraints_count + pin_constraints <= MAX_PIN_CONSTRAINTS)
-				&& (_distance_constraints_count + distance_constraints <= MAX_DISTANCE_CONSTRAINTS)
-				&& (_angular_constraints_count + angular_constraints <= MAX_ANGULAR_CONSTRAINTS)
+				&& CanAllocateConstraints<PinConstraint<T> >(pin_constraints)
+				&& CanAllocateConstraints<DistanceConstraint<T> >(distance_constraints)
+				&& CanAllocateConstraints<AngularConstraint<T> >(angular_constraints)
 				&& (_composite_count + composites <= MAX_COMPOSITES);
 		}
 
-		Particle<T>* AllocateParticles(int count)
+		// Commits the memory for that many more elements of each array at once, ahead of the allocations of a
+		// whole scene. Returns false, reserving nothing, if they would not fit.
+		bool Reserve(int particles, int pin_constraints, int distance_constraints, int angular_constraints,
+			int composites)
+		{
+			if (!CanAllocate(particles, pin_constraints, distance_constraints, angular_constraints, composites))
+			{
+				return false;
+			}
+			int particle_count = _particle_count + particles;
+			_x.Reserve(particle_count);
+			_y.Reserve(particle_count);
+			_last_x.Reserve(particle_count);
+			_last_y.Reserve(particle_count);
+			_radius.Reserve(particle_count);
+			_inverse_mass.Reserve(particle_count);
+			Array<PinConstraint<T> >().storage.Reserve(Array<PinConstraint<T> >().count + pin_constraints);
+			Array<DistanceConstraint<T> >().storage.Reserve(
+				Array<DistanceConstraint<T> >().count + distance_constraints);
+			Array<AngularConstraint<T> >().storage.Reserve(
+				Array<AngularConstraint<T> >().count + angular_constraints);
+			_composite_storage.Reserve(_composite_count + composites);
+			_composite_slot_storage.Reserve(_composite_count + composites);
+			_slot_composites.reserve(_slot_composites.size() + composites);
+			_slot_generations.reserve(_slot_generations.size() + composites);
+			return true;
+		}
+
+		// Returns the index of the first allocated particle, or -1 if the pool is full
+		int AllocateParticles(int count)
 		{
 			if (_particle_count + count > MAX_PARTICLES)
 			{
-				return nullptr;
+				return -1;
 			}
 			_particle_count += count;
-			return _particles + (_particle_count - count);
+			_x.Resize(_particle_count);
+			_y.Resize(_particle_count);
+			_last_x.Resize(_particle_count);
+			_last_y.Resize(_particle_count);
+			_radius.Resize(_particle_count);
+			_inverse_mass.Resize(_particle_count);
+			for (int p = _particle_count - count; p < _particle_count; ++p)
+			{
+				_particles.inverse_mass[p] = 1;
+			}
+			++_topology_version;
+			return _particle_count - count;
 		}
 
 		PinConstraint<T>* AllocatePinConstraints(int count)
 		{
-			if (_pin_constraints_count + count > MAX_PIN_CONSTRAINTS)
+			return AllocateConstraints<PinConstraint<T> >(count);
+		}
+
+		DistanceConstraint<T>* AllocateDistanceConstraints(int count)
+		{
+			return AllocateConstraints<DistanceConstraint<T> >(count);
+		}
+
+		AngularConstraint<T>* AllocateAngularConstraints(int count)
+		{
+			return AllocateConstraints<AngularConstraint<T> >(count);
+		}
+
+		Composite<T>* AllocateComposites(int count)
+		{
+			if (_composite_count + count > MAX_COMPOSITES)
 			{
 				return nullptr;
 			}
-			_pin_constraints_count += count;
-			return _pin_constraints + (_pin_constraints_count - count);
+			_composite_storage.Resize(_composite_count + count);
+			_composite_slot_storage.Resize(_composite_count + count);
+			for (int c = _composite_count; c < _composite_count + count; ++c)
+			{
+				int slot;
+				if (_free_slots.empty())
+				{
+					slot = (int) _slot_composites.size();
+					_slot_composites.push_back(c);
+					_slot_generations.push_back(0);
+				}
+				else
+				{
+					slot = _free_slots.back();
+					_free_slots.pop_back();
+					_slot_composites[slot] = c;
+				}
+				_composite_slots[c] = slot;
+			}
+			_composite_count += count;
+			++_topology_version;
+			return _composites + (_composite_count - count);
 		}
 
-		DistanceConstraint<T>* AllocateDistanceConstraints(int count)
+		// Id of a constraint kind, as used by Composite::AddConstraint
+		template <class Kind>
+		static int KindId()
+		{
+			return KindIndex<Kind, PinConstraint<T>, DistanceConstraint<T>, AngularConstraint<T>, Extra...>::value;
+		}
+
+		template <class Kind>
+		Kind* Constraints() const
+		{
+			return Array<Kind>().storage.data();
+		}
+
+		template <class Kind>
+		int ConstraintCount() const
 		{
-			if (_distance_constraints_count + count > MAX_DISTANCE_CONSTRAINTS)
+			return Array<Kind>().count;
+		}
+
+		template <class Kind>
+		bool CanAllocateConstraints(int count) const
+		{
+			return Array<Kind>().count + count <= (int) Array<Kind>().storage.capacity();
+		}
+
+		// Returns the first of count new constraints of the kind, or nullptr if the pool is full
+		template <class Kind>
+		Kind* AllocateConstraints(int count)
+		{
+			ConstraintArray<Kind>& array = Array<Kind>();
+			if (!array.storage.Resize(array.count + count))
 			{
 				return nullptr;
 			}
-			_distance_constraints_count += count;
-			return _distance_constraints + (_distance_constraints_count - count);
+			array.count += count;
+			++_topology_version;
+			return array.storage.data() + (array.count - count);
 		}
 
-		AngularConstraint<T>* AllocateAngularConstraints(int count)
+		template <class Kind>
+		int Index(const Kind* constraint) const
+		{
+			return (int) (constraint - Constraints<Kind>());
+		}
+
+		// Calls visitor(constraints, count) for every kind, in kind id order
+		template <class V>
+		void VisitConstraints(V& visitor) const
 		{
-			if (_angular_constraints_count + count > MAX_ANGULAR_CONSTRAINTS)
+			visitor(Constraints<PinConstraint<T> >(), ConstraintCount<PinConstraint<T> >());
+			visitor(Constraints<DistanceConstraint<T> >(), ConstraintCount<DistanceConstraint<T> >());
+			visitor(Constraints<AngularConstraint<T> >(), ConstraintCount<AngularConstraint<T> >());
+			int expand[] = {0, (visitor(Constraints<Extra>(), ConstraintCount<Extra>()), 0)...};
+			(void) expand;
+		}
+
+		CompositeHandle Handle(const Composite<T>* composite) const
+		{
+			int slot = _composite_slots[composite - _composites];
+			CompositeHandle handle = {slot, _slot_generations[slot]};
+			return handle;
+		}
+
+		// Returns the current index of the composite, or -1 if it was destroyed
+		int Find(const CompositeHandle& handle) const
+		{
+			if (handle.slot < 0 || handle.slot >= (int) _slot_composites.size()
+				|| _slot_generations[handle.slot] != handle.generation)
 			{
-				return nullptr;
+				return -1;
 			}
-			_angular_constraints_count += count;
-			return _angular_constraints + (_angular_constraints_count - count);
+			return _slot_composites[handle.slot];
 		}
 
-		Composite<T>* AllocateComposites(int count)
+		// Returns the particles and constraints of the composite to the pool, along with any constraint
+		// attached to its particles. The remaining elements are compacted in order, so every array stays
+		// dense and each composite's particles stay contiguous; indices and Composite pointers held outside
+		// the pool are invalidated, handles are not. Returns false for a stale handle.
+		bool DestroyComposite(const CompositeHandle& handle)
 		{
-			if (_composite_count + count > MAX_COMPOSITES)
+			return DestroyComposites(&handle, 1) == 1;
+		}
+
+		// Destroys the composites of count handles like DestroyComposite, with one compaction for all of
+		// them, so tearing down k composites costs one pass over the pool rather than k. Stale handles, and
+		// handles to a composite already in the batch, are skipped. Returns the number destroyed.
+		int DestroyComposites(const CompositeHandle* handles, int count)
+		{
+			// old to new index of every composite and particle, -1 for the removed ones
+			_composite_remap.assign(_composite_count, 0);
+			_particle_remap.assign(_particle_count, 0);
+			int destroyed = 0;
+			for (int h = 0; h < count; ++h)
 			{
-				return nullptr;
+				int composite = Find(handles[h]);
+				if (composite < 0 || _composite_remap[composite] < 0)
+				{
+					continue;
+				}
+				_composite_remap[composite] = -1;
+				const IndexRange& removed = _composites[composite].particles();
+				for (auto it = removed.begin(); it != removed.end(); ++it)
+				{
+					_particle_remap[*it] = -1;
+				}
+
+				// a new generation makes every existing handle to the slot stale
+				_slot_composites[handles[h].slot] = -1;
+				++_slot_generations[handles[h].slot];
+				_free_slots.push_back(handles[h].slot);
+				++destroyed;
 			}
-			_composite_count += count;
-			return _composites + (_composite_count - count);
+			if (destroyed == 0)
+			{
+				return 0;
+			}
+
+			int kept = 0;
+			for (int p = 0; p < _particle_count; ++p)
+			{
+				if (_particle_remap[p] < 0)
+				{
+					continue;
+				}
+				if (kept != p)
+				{
+					_particles.x[kept] = _particles.x[p];
+					_particles.y[kept] = _particles.y[p];
+					_particles.last_x[kept] = _particles.last_x[p];
+					_particles.last_y[kept] = _particles.last_y[p];
+					_particles.radius[kept] = _particles.radius[p];
+					_particles.inverse_mass[kept] = _particles.inverse_mass[p];
+				}
+				_particle_remap[p] = kept++;
+			}
+			_particle_count = kept;
+			_x.Resize(_particle_count);
+			_y.Resize(_particle_count);
+			_last_x.Resize(_particle_count);
+			_last_y.Resize(_particle_count);
+			_radius.Resize(_particle_count);
+			_inverse_mass.Resize(_particle_count);
+
+			CompactConstraints compact = {_particle_remap, _constraint_remaps};
+			ForEachKind(compact);
+
+			kept = 0;
+			for (int c = 0; c < _composite_count; ++c)
+			{
+				if (_composite_remap[c] < 0)
+				{
+					continue;
+				}
+				if (kept != c)
+				{
+					_composites[kept] = _composites[c];
+					_composite_slots[kept] = _composite_slots[c];
+					_slot_composites[_composite_slots[kept]] = kept;
+				}
+				_composites[kept].Reindex(_particle_remap, _constraint_remaps, KIND_COUNT);
+				++kept;
+			}
+			_composite_count = kept;
+			_composite_storage.Resize(_composite_count);
+			_composite_slot_storage.Resize(_composite_count);
+
+			++_topology_version;
+			return destroyed;
 		}
 	};
 }
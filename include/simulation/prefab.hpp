@@ -0,0 +1,296 @@
+
+#ifndef ____prefab__
+#define ____prefab__
+
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <numeric>
+#include <vector>
+
+#include "math/vector2d.hpp"
+#include "verlet/particle.hpp"
+#include "verlet/constraints.hpp"
+#include "verlet/composite.hpp"
+#include "simulation/object_pool.hpp"
+
+
+namespace simulation
+{
+    using namespace verlet;
+
+    // Where one copy of a prefab goes: its origin is moved to position after turning it by angle radians
+    template <class T>
+    struct PrefabInstance
+    {
+        static_assert(std::is_floating_point<T>::value,
+              "PrefabInstance can be of floating point data types only");
+
+        math::Vector2d<T> position;
+        T angle;
+
+        PrefabInstance() : position(0, 0), angle(0)
+        {
+        }
+
+        PrefabInstance(const math::Vector2d<T>& position, T angle) : position(position), angle(angle)
+        {
+        }
+    };
+
+    // Moves a constraint captured relative to the prefab origin into place. Only kinds that hold world
+    // positions need an overload; distances and angles do not change under a rigid move.
+    template <class Kind, class T>
+    void PlaceConstraint(Kind& constraint, T cos_angle, T sin_angle, const math::Vector2d<T>& position)
+    {
+    }
+
+    template <class T>
+    void PlaceConstraint(PinConstraint<T>& constraint, T cos_angle, T sin_angle, const math::Vector2d<T>& position)
+    {
+        math::Vector2d<T> local = constraint.position;
+        constraint.position = math::Vector2d<T>(cos_angle * local.x - sin_angle * local.y + position.x,
+            sin_angle * local.x + cos_angle * local.y + position.y);
+    }
+
+    // Constraints of one kind in a prefab, indexed by prefab particle
+    template <class Kind>
+    struct PrefabBlock
+    {
+        std::vector<Kind> constraints;
+    };
+
+
+    // Copy of a composite that is stamped into a pool any number of times. Capture takes the composite's
+    // particles, relative to an origin, and its constraints with their particles renumbered from 0. Spawn
+    // allocates every array once for a whole batch of instances, then fills each instance with block copies
+    // of the captured arrays, shifting the particle indices and moving the positions into place. Nothing is
+    // recomputed from the shape, so spawning costs about as much as copying the result.
+    template <class T, class... Extra>
+    class Prefab : private PrefabBlock<PinConstraint<T> >, private PrefabBlock<DistanceConstraint<T> >,
+        private PrefabBlock<AngularConstraint<T> >, private PrefabBlock<Extra>...
+    {
+        static_assert(std::is_floating_point<T>::value,
+              "Prefab can be of floating point data types only");
+
+        typedef ObjectPool<T, Extra...> Pool;
+
+        std::vector<T> _x;
+        std::vector<T> _y;
+        std::vector<T> _last_x;
+        std::vector<T> _last_y;
+        std::vector<T> _radius;
+        std::vector<T> _inverse_mass;
+
+        template <class Kind>
+        std::vector<Kind>& Block()
+        {
+            return PrefabBlock<Kind>::constraints;
+        }
+
+        template <class Kind>
+        const std::vector<Kind>& Block() const
+        {
+            return PrefabBlock<Kind>::constraints;
+        }
+
+        // Calls visitor.Visit<Kind>() for every kind, in kind id order, and returns whether all of them
+        // returned true
+        template <class V>
+        static bool AllKinds(V& visitor)
+        {
+            bool results[] = {visitor.template Visit<PinConstraint<T> >(),
+                visitor.template Visit<DistanceConstraint<T> >(), visitor.template Visit<AngularConstraint<T> >(),
+                visitor.template Visit<Extra>()...};
+            return std::find(results, results + (3 + sizeof...(Extra)), false) == results + (3 + sizeof...(Extra));
+        }
+
+        // Copies the composite's constraints of a kind, fails on one reaching outside of the composite
+        struct CaptureConstraints
+        {
+            Prefab& prefab;
+            const Pool& pool;
+            const Composite<T>& composite;
+            const std::vector<int>& particle_remap;
+            math::Vector2d<T> offset;
+
+            template <class Kind>
+            bool Visit()
+            {
+                const IndexRange& indices = composite.constraints(Pool::template KindId<Kind>());
+                const Kind* constraints = pool.template Constraints<Kind>();
+                std::vector<Kind>& block = prefab.Block<Kind>();
+                block.clear();
+                for (auto it = indices.begin(); it != indices.end(); ++it)
+                {
+                    Kind constraint = constraints[*it];
+                    bool inside = true;
+                    constraint.ForEachParticle([&](int particle) {
+                        inside = inside && (particle_remap[particle] >= 0);
+                    });
+                    if (!inside)
+                    {
+                        return false;
+                    }
+                    constraint.Reindex(particle_remap);
+                    PlaceConstraint(constraint, (T) 1, (T) 0, offset);
+                    block.push_back(constraint);
+                }
+                return true;
+            }
+        };
+
+        struct CanSpawnConstraints
+        {
+            const Prefab& prefab;
+            const Pool& pool;
+            long long count;
+
+            template <class Kind>
+            bool Visit()
+            {
+                long long total = count * (long long) prefab.Block<Kind>().size();
+                return total <= INT_MAX && pool.template CanAllocateConstraints<Kind>((int) total);
+            }
+        };
+
+        // Allocates the constraints of a kind for all instances and adds them to the instance composites
+        struct SpawnConstraints
+        {
+            const Prefab& prefab;
+            Pool* pool;
+            const PrefabInstance<T>* instances;
+            int count;
+            int first_particle;
+            Composite<T>* composites;
+
+            template <class Kind>
+            bool Visit()
+            {
+                const std::vector<Kind>& block = prefab.Block<Kind>();
+                const int block_size = (int) block.size();
+                if (block_size == 0)
+                {
+                    return true;
+                }
+                Kind* constraints = pool->template AllocateConstraints<Kind>(count * block_size);
+                const int kind = Pool::template KindId<Kind>();
+                const int first_constraint = pool->Index(constraints);
+
+                const int particle_count = prefab.particle_count();
+                std::vector<int> particle_remap(particle_count);
+                for (int i = 0; i < count; ++i)
+                {
+                    const PrefabInstance<T>& instance = instances[i];
+                    T cos_angle = std::cos(instance.angle);
+                    T sin_angle = std::sin(instance.angle);
+                    Kind* copy = constraints + i * block_size;
+                    std::copy(block.begin(), block.end(), copy);
+
+                    std::iota(particle_remap.begin(), particle_remap.end(), first_particle + i * particle_count);
+                    for (int c = 0; c < block_size; ++c)
+                    {
+                        copy[c].Reindex(particle_remap);
+                        PlaceConstraint(copy[c], cos_angle, sin_angle, instance.position);
+                    }
+                    composites[i].SetConstraints(kind, IndexRange(first_constraint + i * block_size, block_size));
+                }
+                return true;
+            }
+        };
+
+    public:
+        int particle_count() const
+        {
+            return (int) _x.size();
+        }
+
+        template <class Kind>
+        int constraint_count() const
+        {
+            return (int) Block<Kind>().size();
+        }
+
+        // Takes the shape of a composite, with positions relative to origin. Returns false, leaving the
+        // prefab empty, if one of its constraints uses a particle outside of the composite.
+        bool Capture(const Pool& pool, const Composite<T>& composite, const math::Vector2d<T>& origin)
+        {
+            const ParticleArrays<T>& particles = pool.particles;
+            const IndexRange& members = composite.particles();
+            const int count = members.size();
+            _x.resize(count);
+            _y.resize(count);
+            _last_x.resize(count);
+            _last_y.resize(count);
+            _radius.resize(count);
+            _inverse_mass.resize(count);
+
+            std::vector<int> particle_remap(pool.particle_count, -1);
+            for (int i = 0; i < count; ++i)
+            {
+                int particle = members[i];
+                particle_remap[particle] = i;
+                _x[i] = particles.x[particle] - origin.x;
+                _y[i] = particles.y[particle] - origin.y;
+                _last_x[i] = particles.last_x[particle] - origin.x;
+                _last_y[i] = particles.last_y[particle] - origin.y;
+                _radius[i] = particles.radius[particle];
+                _inverse_mass[i] = particles.inverse_mass[particle];
+            }
+
+            math::Vector2d<T> offset(-origin.x, -origin.y);
+            CaptureConstraints capture = {*this, pool, composite, particle_remap, offset};
+            if (!AllKinds(capture))
+            {
+                *this = Prefab();
+                return false;
+            }
+            return true;
+        }
+
+        // Adds count copies of the prefab, one composite each, and returns the first of those composites.
+        // Returns nullptr, adding nothing, if the pool cannot hold all of them.
+        Composite<T>* Spawn(Pool* pool, const PrefabInstance<T>* instances, int count) const
+        {
+            const int particle_count = this->particle_count();
+            long long total_particles = (long long) count * particle_count;
+            CanSpawnConstraints can_spawn = {*this, *pool, count};
+            if (count <= 0 || total_particles > INT_MAX || !pool->CanAllocate((int) total_particles, 0, 0, 0, count)
+                || !AllKinds(can_spawn))
+            {
+                return nullptr;
+            }
+
+            const int first_particle = pool->AllocateParticles((int) total_particles);
+            Composite<T>* composites = pool->AllocateComposites(count);
+            const ParticleArrays<T>& particles = pool->particles;
+            for (int i = 0; i < count; ++i)
+            {
+                const PrefabInstance<T>& instance = instances[i];
+                const T cos_angle = std::cos(instance.angle);
+                const T sin_angle = std::sin(instance.angle);
+                const T x = instance.position.x;
+                const T y = instance.position.y;
+                const int first = first_particle + i * particle_count;
+                for (int p = 0; p < particle_count; ++p)
+                {
+                    particles.x[first + p] = cos_angle * _x[p] - sin_angle * _y[p] + x;
+                    particles.y[first + p] = sin_angle * _x[p] + cos_angle * _y[p] + y;
+                    particles.last_x[first + p] = cos_angle * _last_x[p] - sin_angle * _last_y[p] + x;
+                    particles.last_y[first + p] = sin_angle * _last_x[p] + cos_angle * _last_y[p] + y;
+                }
+                std::copy(_radius.begin(), _radius.end(), particles.radius + first);
+                std::copy(_inverse_mass.begin(), _inverse_mass.end(), particles.inverse_mass + first);
+                composites[i].SetParticles(IndexRange(first, particle_count));
+            }
+
+            SpawnConstraints spawn = {*this, pool, instances, count, first_particle, composites};
+            AllKinds(spawn);
+            return composites;
+        }
+    };
+}
+
+
+#endif /* defined(____prefab__) */
@@ -0,0 +1,94 @@
+
+#ifndef ____render_snapshot__
+#define ____render_snapshot__
+
+
+#include <chrono>
+#include <vector>
+
+#include "math/vector2d.hpp"
+#include "verlet/particle.hpp"
+#include "verlet/constraints.hpp"
+#include "simulation/object_pool.hpp"
+
+
+namespace simulation
+{
+    // Copy of what the renderer needs from the pool after a step: positions after and before the step, so
+    // frames can interpolate between them, and the particles of the drawn constraints. Captured by the
+    // simulation thread and read by the render thread, which never touches the pool.
+    struct RenderSnapshot
+    {
+        typedef std::chrono::steady_clock Clock;
+
+        std::vector<float> x;
+        std::vector<float> y;
+        std::vector<float> last_x;
+        std::vector<float> last_y;
+        // particle1, particle2 of each distance constraint
+        std::vector<int> distance_particles;
+        std::vector<int> pin_particles;
+        // when the step finished and how long it was
+        Clock::time_point time;
+        float time_step;
+
+        RenderSnapshot() : time_step(0)
+        {
+        }
+
+        // Copies the pool; the vectors keep their capacity, so steady scenes do not allocate
+        void Capture(const ObjectPool<float>& object_pool, float step, Clock::time_point now)
+        {
+            const verlet::ParticleArrays<float>& particles = object_pool.particles;
+            int particle_count = object_pool.particle_count;
+            x.assign(particles.x, particles.x + particle_count);
+            y.assign(particles.y, particles.y + particle_count);
+            last_x.assign(particles.last_x, particles.last_x + particle_count);
+            last_y.assign(particles.last_y, particles.last_y + particle_count);
+
+            const verlet::DistanceConstraint<float>* distance_constraints = object_pool.distance_constraints;
+            distance_particles.resize(object_pool.distance_constraints_count * 2);
+            for (int c = 0; c < object_pool.distance_constraints_count; ++c)
+            {
+                distance_particles[2 * c] = distance_constraints[c].particle1;
+                distance_particles[2 * c + 1] = distance_constraints[c].particle2;
+            }
+
+            const verlet::PinConstraint<float>* pin_constraints = object_pool.pin_constraints;
+            pin_particles.resize(object_pool.pin_constraints_count);
+            for (int c = 0; c < object_pool.pin_constraints_count; ++c)
+            {
+                pin_particles[c] = pin_constraints[c].particle;
+            }
+
+            time = now;
+            time_step = step;
+        }
+
+        int particle_count() const
+        {
+            return (int) x.size();
+        }
+
+        // Position of a particle alpha of the way from before the step (0) to after it (1)
+        math::Vector2d<float> Position(int particle, float alpha) const
+        {
+            return math::Vector2d<float>(last_x[particle] + (x[particle] - last_x[particle]) * alpha,
+                last_y[particle] + (y[particle] - last_y[particle]) * alpha);
+        }
+
+        // How far the render at now is from the start of the step to its end. Frames are drawn one step
+        // behind the simulation, so they always fall between two known states.
+        float Interpolation(Clock::time_point now) const
+        {
+            if (time_step <= 0)
+            {
+                return 1;
+            }
+            float alpha = std::chrono::duration<float>(now - time).count() / time_step;
+            return (alpha < 0) ? 0 : ((alpha > 1) ? 1 : alpha);
+        }
+    };
+}
+
+#endif /* defined(____render_snapshot__) */
@@ -0,0 +1,51 @@
+
+#ifndef ____renderer__
+#define ____renderer__
+
+
+#include <vector>
+
+#include "SDL2/SDL.h"
+
+#include "math/vector2d.hpp"
+#include "simulation/render_snapshot.hpp"
+
+
+namespace simulation
+{
+    // Draws a snapshot of the pool in one SDL_RenderGeometry call per frame. Every particle, pin and
+    // constraint becomes a quad in a single vertex and index buffer, refilled in one pass over the snapshot.
+    // Particles and pins sample a circle sprite; constraints sample its opaque centre texel, so they share
+    // the same texture and the whole frame stays one batch however many objects there are.
+    class Renderer
+    {
+    private:
+        SDL_Renderer* renderer;
+        SDL_Texture* sprite;
+
+        std::vector<SDL_Vertex> vertices;
+        std::vector<int> indices;
+        // interpolated particle positions of the frame being drawn
+        std::vector<math::Vector2d<float> > positions;
+
+        bool CreateSprite();
+
+        void AddQuad(const SDL_FPoint* corners, const SDL_FPoint* tex_coords, SDL_Color color);
+        void AddCircle(const math::Vector2d<float>& center, float radius, SDL_Color color);
+        void AddLine(const math::Vector2d<float>& start, const math::Vector2d<float>& end, float width,
+            SDL_Color color);
+    public:
+        Renderer();
+        ~Renderer();
+
+        // Returns false when the sprite texture cannot be created on renderer
+        bool Initialize(SDL_Renderer* renderer);
+        void Destroy();
+
+        // Batches and submits the particles, distance constraints and pins of the snapshot, at alpha of the
+        // way through its step
+        void Draw(const RenderSnapshot& snapshot, float alpha);
+    };
+}
+
+#endif /* defined(____renderer__) */
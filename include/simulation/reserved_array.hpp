@@ -0,0 +1,128 @@
+
+#ifndef ____reserved_array__
+#define ____reserved_array__
+
+
+#include <cstddef>
+#include <new>
+#include <sys/mman.h>
+
+
+namespace simulation
+{
+    // Array with a fixed address range reserved up front and committed in CHUNK_BYTES steps as it grows.
+    // Elements keep their address for the lifetime of the array, and only the elements below the
+    // high-water mark of Resize are ever constructed, so reserving room for millions costs nothing until
+    // they are used.
+    template <class E>
+    class ReservedArray
+    {
+        static const size_t CHUNK_BYTES = 64 * 1024;
+
+        E* _data;
+        size_t _capacity;
+        size_t _reserved_bytes;
+        size_t _committed_bytes;
+        size_t _size;
+
+        void Commit(size_t bytes)
+        {
+            if (bytes <= _committed_bytes)
+            {
+                return;
+            }
+            size_t target = ((bytes + CHUNK_BYTES - 1) / CHUNK_BYTES) * CHUNK_BYTES;
+            target = (target < _reserved_bytes) ? target : _reserved_bytes;
+            if (mprotect(reinterpret_cast<char*>(_data) + _committed_bytes, target - _committed_bytes,
+                PROT_READ | PROT_WRITE) != 0)
+            {
+                throw std::bad_alloc();
+            }
+            _committed_bytes = target;
+        }
+
+    public:
+        explicit ReservedArray(size_t capacity) : _data(nullptr), _capacity(capacity), _committed_bytes(0), _size(0)
+        {
+            _reserved_bytes = ((capacity * sizeof(E) + CHUNK_BYTES - 1) / CHUNK_BYTES) * CHUNK_BYTES;
+            if (_reserved_bytes == 0)
+            {
+                return;
+            }
+            void* address = mmap(nullptr, _reserved_bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                -1, 0);
+            if (address == MAP_FAILED)
+            {
+                throw std::bad_alloc();
+            }
+            _data = static_cast<E*>(address);
+        }
+
+        ~ReservedArray()
+        {
+            Resize(0);
+            if (_data != nullptr)
+            {
+                munmap(_data, _reserved_bytes);
+            }
+        }
+
+        ReservedArray(const ReservedArray&) = delete;
+        ReservedArray& operator=(const ReservedArray&) = delete;
+
+        E* data() const
+        {
+            return _data;
+        }
+
+        size_t capacity() const
+        {
+            return _capacity;
+        }
+
+        size_t size() const
+        {
+            return _size;
+        }
+
+        E& operator[](size_t index) const
+        {
+            return _data[index];
+        }
+
+        // Commits memory for size elements without constructing them, so a later Resize up to size does not
+        // fault in pages piecemeal. Returns false if size is over capacity.
+        bool Reserve(size_t size)
+        {
+            if (size > _capacity)
+            {
+                return false;
+            }
+            Commit(size * sizeof(E));
+            return true;
+        }
+
+        // Constructs the elements up to size, committing memory as needed, or destroys the ones past it.
+        // Returns false if size is over capacity.
+        bool Resize(size_t size)
+        {
+            if (size > _capacity)
+            {
+                return false;
+            }
+            Commit(size * sizeof(E));
+            for (; _size < size; ++_size)
+            {
+                new (_data + _size) E();
+            }
+            for (; _size > size; --_size)
+            {
+                _data[_size - 1].~E();
+            }
+            return true;
+        }
+    };
+}
+
+
+#endif /* defined(____reserved_array__) */
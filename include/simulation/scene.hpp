@@ -0,0 +1,786 @@
+
+#ifndef ____scene__
+#define ____scene__
+
+
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "math/vector2d.hpp"
+#include "verlet/composite.hpp"
+#include "verlet/objects.hpp"
+#include "verlet/verlet.hpp"
+#include "simulation/object_pool.hpp"
+
+
+namespace simulation
+{
+    // Scene files describe a scene as JSON, one entry per call to a builder of verlet/objects.hpp:
+    //
+    //     {
+    //         "collision_radius": 3,
+    //         "distance_mode": "xpbd",
+    //         "compliance": 0.0001,
+    //         "objects": [
+    //             {"type": "point", "position": [10, 20]},
+    //             {"type": "line_segments", "vertices": [[0, 0], [20, 0], [40, 0]], "pins": [0],
+    //                 "position": [400, 30], "stiffness": 0.2},
+    //             {"type": "polygon", "vertices": [[0, 0], [50, 0], [0, 50]],
+    //                 "constraints": [[0, 1], [1, 2], [2, 0]], "position": [100, 200], "stiffness": 1},
+    //             {"type": "tire", "origin": [500, 200], "radius": 100, "segments": 30,
+    //                 "spoke_stiffness": 1, "tread_stiffness": 1},
+    //             {"type": "cloth", "top_left": [700, 50], "width": 300, "height": 350, "segments": 20,
+    //                 "pin_mod": 5, "stiffness": 0.9}
+    //         ]
+    //     }
+    //
+    // position (for the vertex lists), pins, the stiffnesses, compliance and collision_radius are optional; an
+    // object's collision_radius or compliance overrides the scene's, which default to 0 (no collisions, rigid).
+    // Pins, constraints and vertices index into the object's own vertex list. Tires need more than 5 segments.
+    //
+    // distance_mode is one of "approximate", "exact" and "xpbd", see verlet::DistanceMode, and is left to the
+    // caller to apply. Compliance is the inverse stiffness of the distance constraints in xpbd mode, which
+    // ignores stiffness; the other modes ignore compliance.
+    //
+    // The whole file is parsed and checked, and the pool reserved for all of it, before anything is built,
+    // so a scene either loads completely or leaves the pool as it was.
+    enum SceneObjectType
+    {
+        SCENE_POINT = 0,
+        SCENE_LINE_SEGMENTS,
+        SCENE_POLYGON,
+        SCENE_TIRE,
+        SCENE_CLOTH
+    };
+
+    // Arguments of one builder call; which fields are used depends on the type
+    template <class T>
+    struct SceneObject
+    {
+        static_assert(std::is_floating_point<T>::value,
+              "SceneObject can be of floating point data types only");
+
+        SceneObjectType type;
+        std::vector<math::Vector2d<T> > vertices;
+        std::vector<int> pins;
+        std::vector<std::pair<int, int> > constraints;
+        // point position, vertex offset, tire origin or cloth top left
+        math::Vector2d<T> position;
+        // also the tread stiffness of a tire
+        T stiffness;
+        T spoke_stiffness;
+        // compliance of every distance constraint
+        T compliance;
+        T radius;
+        int width;
+        int height;
+        int segments;
+        int pin_mod;
+        T collision_radius;
+
+        SceneObject() : type(SCENE_POINT), position(0, 0), stiffness(1), spoke_stiffness(1), compliance(0), radius(0),
+            width(0),
+            height(0), segments(0), pin_mod(1), collision_radius(0)
+        {
+        }
+    };
+
+    namespace scene_detail
+    {
+        enum JsonType
+        {
+            JSON_NULL = 0,
+            JSON_BOOL,
+            JSON_NUMBER,
+            JSON_STRING,
+            JSON_ARRAY,
+            JSON_OBJECT
+        };
+
+        // One value of a parsed document. Nodes are stored in document order, so the first child of an array
+        // or object is the node right after it, and every node knows where its subtree ends.
+        struct JsonNode
+        {
+            JsonType type;
+            double number;
+            // member name when the parent is an object
+            std::string key;
+            std::string text;
+            // children of an array or object
+            int count;
+            // index of the node after the subtree, the next sibling
+            int end;
+
+            JsonNode() : type(JSON_NULL), number(0), count(0), end(0)
+            {
+            }
+        };
+
+        class JsonParser
+        {
+            static const int MAX_DEPTH = 64;
+
+            const char* _p;
+            const char* _end;
+            std::vector<JsonNode>& _nodes;
+
+            void SkipSpace()
+            {
+                while (_p < _end && (*_p == ' ' || *_p == '\t' || *_p == '\n' || *_p == '\r'))
+                {
+                    ++_p;
+                }
+            }
+
+            bool Expect(char c)
+            {
+                SkipSpace();
+                if (_p < _end && *_p == c)
+                {
+                    ++_p;
+                    return true;
+                }
+                return false;
+            }
+
+            bool Literal(const char* word)
+            {
+                size_t length = std::strlen(word);
+                if ((size_t) (_end - _p) < length || std::memcmp(_p, word, length) != 0)
+                {
+                    return false;
+                }
+                _p += length;
+                return true;
+            }
+
+            // Appends the code point as UTF-8; surrogate pairs are not combined
+            static void AppendUtf8(std::string& out, unsigned code)
+            {
+                if (code < 0x80)
+                {
+                    out += (char) code;
+                }
+                else if (code < 0x800)
+                {
+                    out += (char) (0xC0 | (code >> 6));
+                    out += (char) (0x80 | (code & 0x3F));
+                }
+                else
+                {
+                    out += (char) (0xE0 | (code >> 12));
+                    out += (char) (0x80 | ((code >> 6) & 0x3F));
+                    out += (char) (0x80 | (code & 0x3F));
+                }
+            }
+
+            bool ParseString(std::string& out)
+            {
+                if (!Expect('"'))
+                {
+                    return false;
+                }
+                while (_p < _end && *_p != '"')
+                {
+                    char c = *_p++;
+                    if (c != '\\')
+                    {
+                        out += c;
+                        continue;
+                    }
+                    if (_p >= _end)
+                    {
+                        return false;
+                    }
+                    char escape = *_p++;
+                    switch (escape)
+                    {
+                        case '"': case '\\': case '/': out += escape; break;
+                        case 'b': out += '\b'; break;
+                        case 'f': out += '\f'; break;
+                        case 'n': out += '\n'; break;
+                        case 'r': out += '\r'; break;
+                        case 't': out += '\t'; break;
+                        case 'u':
+                        {
+                            if (_end - _p < 4)
+                            {
+                                return false;
+                            }
+                            char hex[5] = {_p[0], _p[1], _p[2], _p[3], '\0'};
+                            char* hex_end;
+                            unsigned code = (unsigned) std::strtoul(hex, &hex_end, 16);
+                            if (hex_end != hex + 4)
+                            {
+                                return false;
+                            }
+                            AppendUtf8(out, code);
+                            _p += 4;
+                            break;
+                        }
+                        default: return false;
+                    }
+                }
+                if (_p >= _end)
+                {
+                    return false;
+                }
+                ++_p;
+                return true;
+            }
+
+            bool ParseNumber(double& number)
+            {
+                // copied out, the text does not have to be null terminated
+                char token[64];
+                size_t length = 0;
+                while (_p + length < _end && length < sizeof(token) - 1
+                    && std::strchr("+-0123456789.eE", _p[length]) != nullptr && _p[length] != '\0')
+                {
+                    token[length] = _p[length];
+                    ++length;
+                }
+                token[length] = '\0';
+                char* token_end;
+                number = std::strtod(token, &token_end);
+                if (length == 0 || token_end != token + length)
+                {
+                    return false;
+                }
+                _p += length;
+                return true;
+            }
+
+            bool ParseValue(int depth, std::string& key)
+            {
+                SkipSpace();
+                if (_p >= _end || depth > MAX_DEPTH)
+                {
+                    return false;
+                }
+
+                // the vector grows under the recursion, so the node is only ever reached through its index
+                int index = (int) _nodes.size();
+                _nodes.push_back(JsonNode());
+                _nodes[index].key.swap(key);
+
+                char c = *_p;
+                if (c == '{' || c == '[')
+                {
+                    bool object = (c == '{');
+                    char close = object ? '}' : ']';
+                    _nodes[index].type = object ? JSON_OBJECT : JSON_ARRAY;
+                    ++_p;
+                    if (!Expect(close))
+                    {
+                        int count = 0;
+                        do
+                        {
+                            std::string name;
+                            if (object && !(ParseString(name) && Expect(':')))
+                            {
+                                return false;
+                            }
+                            if (!ParseValue(depth + 1, name))
+                            {
+                                return false;
+                            }
+                            ++count;
+                        }
+                        while (Expect(','));
+                        if (!Expect(close))
+                        {
+                            return false;
+                        }
+                        _nodes[index].count = count;
+                    }
+                }
+                else if (c == '"')
+                {
+                    _nodes[index].type = JSON_STRING;
+                    if (!ParseString(_nodes[index].text))
+                    {
+                        return false;
+                    }
+                }
+                else if (Literal("true") || Literal("false"))
+                {
+                    _nodes[index].type = JSON_BOOL;
+                    _nodes[index].number = (c == 't') ? 1 : 0;
+                }
+                else if (Literal("null"))
+                {
+                    _nodes[index].type = JSON_NULL;
+                }
+                else
+                {
+                    _nodes[index].type = JSON_NUMBER;
+                    if (!ParseNumber(_nodes[index].number))
+                    {
+                        return false;
+                    }
+                }
+                _nodes[index].end = (int) _nodes.size();
+                return true;
+            }
+
+        public:
+            JsonParser(const char* text, size_t length, std::vector<JsonNode>& nodes)
+                : _p(text), _end(text + length), _nodes(nodes)
+            {
+            }
+
+            // Parses the whole text as one value, node 0 is the root
+            bool Parse()
+            {
+                _nodes.clear();
+                std::string key;
+                if (!ParseValue(0, key))
+                {
+                    return false;
+                }
+                SkipSpace();
+                return (_p == _end);
+            }
+        };
+
+        // Index of the named member of an object node, -1 if there is none
+        inline int Find(const std::vector<JsonNode>& nodes, int object, const char* name)
+        {
+            int child = object + 1;
+            for (int i = 0; i < nodes[object].count; ++i, child = nodes[child].end)
+            {
+                if (nodes[child].key == name)
+                {
+                    return child;
+                }
+            }
+            return -1;
+        }
+
+        // The readers below fill in value from the named member of an object node. A missing member is
+        // only an error when required; a member of the wrong type always is.
+        template <class T>
+        bool ReadNumber(const std::vector<JsonNode>& nodes, int object, const char* name, T& value, bool required)
+        {
+            int node = Find(nodes, object, name);
+            if (node < 0)
+            {
+                return !required;
+            }
+            if (nodes[node].type != JSON_NUMBER)
+            {
+                return false;
+            }
+            value = (T) nodes[node].number;
+            return true;
+        }
+
+        inline bool ToInteger(const JsonNode& node, int& value)
+        {
+            if (node.type != JSON_NUMBER || node.number < INT_MIN || node.number > INT_MAX
+                || node.number != (double) (int) node.number)
+            {
+                return false;
+            }
+            value = (int) node.number;
+            return true;
+        }
+
+        inline bool ReadInteger(const std::vector<JsonNode>& nodes, int object, const char* name, int& value,
+            bool required)
+        {
+            int node = Find(nodes, object, name);
+            if (node < 0)
+            {
+                return !required;
+            }
+            return ToInteger(nodes[node], value);
+        }
+
+        template <class T>
+        bool ToVector(const std::vector<JsonNode>& nodes, int node, math::Vector2d<T>& value)
+        {
+            if (nodes[node].type != JSON_ARRAY || nodes[node].count != 2 || nodes[node + 1].type != JSON_NUMBER
+                || nodes[node + 2].type != JSON_NUMBER)
+            {
+                return false;
+            }
+            value = math::Vector2d<T>((T) nodes[node + 1].number, (T) nodes[node + 2].number);
+            return true;
+        }
+
+        template <class T>
+        bool ReadVector(const std::vector<JsonNode>& nodes, int object, const char* name, math::Vector2d<T>& value,
+            bool required)
+        {
+            int node = Find(nodes, object, name);
+            if (node < 0)
+            {
+                return !required;
+            }
+            return ToVector(nodes, node, value);
+        }
+
+        template <class T>
+        bool ReadVectors(const std::vector<JsonNode>& nodes, int object, const char* name,
+            std::vector<math::Vector2d<T> >& values)
+        {
+            int node = Find(nodes, object, name);
+            if (node < 0 || nodes[node].type != JSON_ARRAY)
+            {
+                return false;
+            }
+            values.resize(nodes[node].count);
+            int child = node + 1;
+            for (int i = 0; i < nodes[node].count; ++i, child = nodes[child].end)
+            {
+                if (!ToVector(nodes, child, values[i]))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Indices into a list of count elements
+        inline bool ReadIndices(const std::vector<JsonNode>& nodes, int object, const char* name, int count,
+            std::vector<int>& values)
+        {
+            int node = Find(nodes, object, name);
+            if (node < 0)
+            {
+                return true;
+            }
+            if (nodes[node].type != JSON_ARRAY)
+            {
+                return false;
+            }
+            values.resize(nodes[node].count);
+            int child = node + 1;
+            for (int i = 0; i < nodes[node].count; ++i, child = nodes[child].end)
+            {
+                if (!ToInteger(nodes[child], values[i]) || values[i] < 0 || values[i] >= count)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Pairs of distinct indices into a list of count elements
+        inline bool ReadIndexPairs(const std::vector<JsonNode>& nodes, int object, const char* name, int count,
+            std::vector<std::pair<int, int> >& values)
+        {
+            int node = Find(nodes, object, name);
+            if (node < 0)
+            {
+                return true;
+            }
+            if (nodes[node].type != JSON_ARRAY)
+            {
+                return false;
+            }
+            values.resize(nodes[node].count);
+            int child = node + 1;
+            for (int i = 0; i < nodes[node].count; ++i, child = nodes[child].end)
+            {
+                std::pair<int, int>& pair = values[i];
+                if (nodes[child].type != JSON_ARRAY || nodes[child].count != 2
+                    || !ToInteger(nodes[child + 1], pair.first) || !ToInteger(nodes[child + 2], pair.second)
+                    || pair.first < 0 || pair.first >= count || pair.second < 0 || pair.second >= count
+                    || pair.first == pair.second)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Pool elements taken by a scene
+        struct SceneSize
+        {
+            long long particles;
+            long long pin_constraints;
+            long long distance_constraints;
+            long long composites;
+
+            bool fits_int() const
+            {
+                return particles <= INT_MAX && pin_constraints <= INT_MAX && distance_constraints <= INT_MAX
+                    && composites <= INT_MAX;
+            }
+        };
+
+        // Reads and checks one entry of the objects list
+        template <class T>
+        bool ReadObject(const std::vector<JsonNode>& nodes, int node, SceneObject<T>& object)
+        {
+            int type = Find(nodes, node, "type");
+            if (nodes[node].type != JSON_OBJECT || type < 0
+                || !ReadNumber(nodes, node, "collision_radius", object.collision_radius, false)
+                || !ReadNumber(nodes, node, "compliance", object.compliance, false) || object.compliance < 0)
+            {
+                return false;
+            }
+
+            const std::string& name = nodes[type].text;
+            if (name == "point")
+            {
+                object.type = SCENE_POINT;
+                if (!ReadVector(nodes, node, "position", object.position, true))
+                {
+                    return false;
+                }
+            }
+            else if (name == "line_segments" || name == "polygon")
+            {
+                bool line = (name == "line_segments");
+                object.type = line ? SCENE_LINE_SEGMENTS : SCENE_POLYGON;
+                if (!ReadVectors(nodes, node, "vertices", object.vertices) || object.vertices.empty()
+                    || !ReadVector(nodes, node, "position", object.position, false)
+                    || !ReadNumber(nodes, node, "stiffness", object.stiffness, false))
+                {
+                    return false;
+                }
+                int vertex_count = (int) object.vertices.size();
+                return line ? ReadIndices(nodes, node, "pins", vertex_count, object.pins)
+                    : ReadIndexPairs(nodes, node, "constraints", vertex_count, object.constraints);
+            }
+            else if (name == "tire")
+            {
+                object.type = SCENE_TIRE;
+                if (!ReadVector(nodes, node, "origin", object.position, true)
+                    || !ReadNumber(nodes, node, "radius", object.radius, true)
+                    || !ReadInteger(nodes, node, "segments", object.segments, true)
+                    || !ReadNumber(nodes, node, "spoke_stiffness", object.spoke_stiffness, false)
+                    || !ReadNumber(nodes, node, "tread_stiffness", object.stiffness, false)
+                    || object.radius <= 0 || object.segments <= 5)
+                {
+                    return false;
+                }
+            }
+            else if (name == "cloth")
+            {
+                object.type = SCENE_CLOTH;
+                if (!ReadVector(nodes, node, "top_left", object.position, true)
+                    || !ReadInteger(nodes, node, "width", object.width, true)
+                    || !ReadInteger(nodes, node, "height", object.height, true)
+                    || !ReadInteger(nodes, node, "segments", object.segments, true)
+                    || !ReadInteger(nodes, node, "pin_mod", object.pin_mod, false)
+                    || !ReadNumber(nodes, node, "stiffness", object.stiffness, false)
+                    || object.width <= 0 || object.height <= 0 || object.segments <= 0 || object.pin_mod <= 0)
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                return false;
+            }
+            return true;
+        }
+
+        template <class T, class... Extra>
+        Composite<T>* Build(SceneObject<T>& object, ObjectPool<T, Extra...>* object_pool)
+        {
+            switch (object.type)
+            {
+                case SCENE_POINT:
+                    return Point<T>(object.position, object_pool);
+                case SCENE_LINE_SEGMENTS:
+                    return LineSegments<T>(object.vertices, object.pins, object.position, object.stiffness,
+                        object_pool, object.compliance);
+                case SCENE_POLYGON:
+                    return Polygon<T>(object.vertices, object.constraints, object.position,
+                        object.stiffness, object_pool, object.compliance);
+                case SCENE_TIRE:
+                    return Tire<T>(object.position, object.radius, object.segments, object.spoke_stiffness,
+                        object.stiffness, object_pool, object.compliance);
+                case SCENE_CLOTH:
+                    return Cloth<T>(object.position, object.width, object.height, object.segments,
+                        object.pin_mod, object.stiffness, object_pool, object.compliance);
+            }
+            return nullptr;
+        }
+
+        // Reads the optional distance_mode of the scene into mode, leaving it as it was when there is none
+        inline bool ReadDistanceMode(const std::vector<JsonNode>& nodes, int object, verlet::DistanceMode& mode)
+        {
+            int node = Find(nodes, object, "distance_mode");
+            if (node < 0)
+            {
+                return true;
+            }
+            if (nodes[node].type != JSON_STRING)
+            {
+                return false;
+            }
+            const std::string& name = nodes[node].text;
+            if (name == "approximate")
+            {
+                mode = verlet::DistanceMode::Approximate;
+            }
+            else if (name == "exact")
+            {
+                mode = verlet::DistanceMode::Exact;
+            }
+            else if (name == "xpbd")
+            {
+                mode = verlet::DistanceMode::Xpbd;
+            }
+            else
+            {
+                return false;
+            }
+            return true;
+        }
+    }
+
+    // Parses a scene description, see above, into its builder calls, and its distance_mode, if it has one,
+    // into distance_mode when given one. Returns false if the text is not a valid scene.
+    template <class T>
+    bool ParseScene(const char* text, size_t length, std::vector<SceneObject<T> >& objects,
+        verlet::DistanceMode* distance_mode = nullptr)
+    {
+        using namespace scene_detail;
+
+        std::vector<JsonNode> nodes;
+        JsonParser parser(text, length, nodes);
+        if (!parser.Parse() || nodes[0].type != JSON_OBJECT)
+        {
+            return false;
+        }
+
+        T collision_radius = 0;
+        T compliance = 0;
+        verlet::DistanceMode mode = (distance_mode != nullptr) ? *distance_mode : verlet::DistanceMode::Approximate;
+        int list = Find(nodes, 0, "objects");
+        if (!ReadNumber(nodes, 0, "collision_radius", collision_radius, false)
+            || !ReadNumber(nodes, 0, "compliance", compliance, false) || compliance < 0
+            || !ReadDistanceMode(nodes, 0, mode) || list < 0 || nodes[list].type != JSON_ARRAY)
+        {
+            return false;
+        }
+
+        objects.clear();
+        objects.resize(nodes[list].count);
+        int node = list + 1;
+        for (int i = 0; i < nodes[list].count; ++i, node = nodes[node].end)
+        {
+            objects[i].collision_radius = collision_radius;
+            objects[i].compliance = compliance;
+            if (!ReadObject(nodes, node, objects[i]))
+            {
+                return false;
+            }
+        }
+        if (distance_mode != nullptr)
+        {
+            *distance_mode = mode;
+        }
+        return true;
+    }
+
+    // Builds a parsed scene into the pool. Everything it needs is reserved in one go first; returns false,
+    // building nothing, if the pool cannot hold it.
+    template <class T, class... Extra>
+    bool BuildScene(std::vector<SceneObject<T> >& objects, ObjectPool<T, Extra...>* object_pool)
+    {
+        using namespace scene_detail;
+
+        // the sizing pass
+        SceneSize size = {0, 0, 0, 0};
+        for (auto it = objects.begin(); it != objects.end(); ++it)
+        {
+            const SceneObject<T>& object = *it;
+            long long vertex_count = object.vertices.size();
+            long long segments = object.segments;
+            switch (object.type)
+            {
+                case SCENE_POINT:
+                    size.particles += 1;
+                    break;
+                case SCENE_LINE_SEGMENTS:
+                    size.particles += vertex_count;
+                    size.pin_constraints += object.pins.size();
+                    size.distance_constraints += vertex_count - 1;
+                    break;
+                case SCENE_POLYGON:
+                    size.particles += vertex_count;
+                    size.distance_constraints += object.constraints.size();
+                    break;
+                case SCENE_TIRE:
+                    size.particles += segments + 1;
+                    size.distance_constraints += 3 * segments;
+                    break;
+                case SCENE_CLOTH:
+                    size.particles += segments * segments;
+                    size.pin_constraints += ClothPinCount(object.segments, object.pin_mod);
+                    size.distance_constraints += 2 * segments * (segments - 1);
+                    break;
+            }
+            ++size.composites;
+        }
+        if (!size.fits_int() || !object_pool->Reserve((int) size.particles, (int) size.pin_constraints,
+            (int) size.distance_constraints, 0, (int) size.composites))
+        {
+            return false;
+        }
+
+        for (auto it = objects.begin(); it != objects.end(); ++it)
+        {
+            // cannot fail once the pool is reserved
+            Composite<T>* composite = Build(*it, object_pool);
+            if (composite == nullptr)
+            {
+                return false;
+            }
+            SetCollisionRadius<T>(*composite, object_pool->particles, it->collision_radius);
+        }
+        return true;
+    }
+
+    // Reads, checks and builds the scene file at path into the pool, and its distance_mode, if it has one,
+    // into distance_mode when given one. Returns false, leaving the pool and distance_mode as they were, if
+    // the file cannot be read, is not a valid scene or does not fit.
+    template <class T, class... Extra>
+    bool LoadScene(const char* path, ObjectPool<T, Extra...>* object_pool,
+        verlet::DistanceMode* distance_mode = nullptr)
+    {
+        FILE* file = std::fopen(path, "rb");
+        if (file == nullptr)
+        {
+            return false;
+        }
+        std::string text;
+        char buffer[64 * 1024];
+        size_t read;
+        while ((read = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+        {
+            text.append(buffer, read);
+        }
+        bool failed = (std::ferror(file) != 0);
+        std::fclose(file);
+
+        std::vector<SceneObject<T> > objects;
+        verlet::DistanceMode mode = (distance_mode != nullptr) ? *distance_mode : verlet::DistanceMode::Approximate;
+        if (failed || !ParseScene(text.data(), text.size(), objects, &mode) || !BuildScene(objects, object_pool))
+        {
+            return false;
+        }
+        if (distance_mode != nullptr)
+        {
+            *distance_mode = mode;
+        }
+        return true;
+    }
+}
+
+
+#endif /* defined(____scene__) */
@@ -1,43 +1,74 @@
 
+#include <atomic>
+#include <string>
+#include <thread>
+
 #include "SDL2/SDL.h"
 
 #include "math/vector2d.hpp"
-#include "verlet/verlet.hpp"
+#include "simulation/render_snapshot.hpp"
+#include "simulation/renderer.hpp"
+#include "simulation/triple_buffer.hpp"
+#include "simulation/world.hpp"
 
 
 namespace simulation
 {
+    // Mouse drag as seen by the input thread, handed to the simulation thread. Presses and releases are
+    // counted, so the simulation thread sees every edge since the state it last read, even a click that
+    // went down and up within one frame, and only grabs on a new press.
+    struct DragInput
+    {
+        bool active;
+        math::Vector2d<float> position;
+        // where the last press went down
+        math::Vector2d<float> press_position;
+        unsigned presses;
+        unsigned releases;
+
+        DragInput() : active(false), position(0, 0), press_position(0, 0), presses(0), releases(0)
+        {
+        }
+    };
+
     class Simulation
     {
     private:
-        float world_width;
-        float world_height;
-        float world_aspect_ratio;
         int renderer_width;
         int renderer_height;
 
         SDL_Window* window;
         SDL_Renderer* renderer;
+        Renderer scene_renderer;
 
-        simulation::ObjectPool<float>* object_pool;
-        verlet::Verlet<float>* world;
+        // owned by physics_thread once it runs; the render thread only sees the snapshots it publishes
+        simulation::World* world;
+        TripleBuffer<RenderSnapshot> snapshots;
+        std::thread physics_thread;
+        std::atomic<bool> running;
+        // drag state of the input thread and its hand over to the simulation thread
+        DragInput drag;
+        TripleBuffer<DragInput> drag_input;
+        // trajectory to play back instead of simulating, empty for none
+        std::string replay_path;
 
         int InitializeSDL();
         void DestroySDL();
-        bool CreateWorld(int width, int height);
 
-        inline bool CreateLineSegments();
-        inline bool CreateBoxes();
-        inline bool CreateTire();
-        inline bool CreateCloth();
+        // Steps the world in real time on the simulation thread and publishes a snapshot after each step
+        void RunPhysics();
+        // Plays the trajectory file at replay_path on the simulation thread instead, see simulation/trajectory.hpp
+        void RunReplay();
 
         inline math::Vector2d<float> ScaleFromWorldToRenderer(math::Vector2d<float> position) const;
+        inline math::Vector2d<float> ScaleFromRendererToWorld(math::Vector2d<float> position) const;
     public:
-        Simulation();
+        // Simulates the scene file at scene_path, or the demo scene without one. Given a trajectory file at
+        // replay_path it is played back over the scene instead.
+        Simulation(const char* replay_path = nullptr, const char* scene_path = nullptr);
         ~Simulation();
 
         bool HandleInput();
-        void Update();
         void Draw();
     };
 }
\ No newline at end of file
@@ -0,0 +1,517 @@
+
+#ifndef ____snapshot__
+#define ____snapshot__
+
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "verlet/particle.hpp"
+#include "verlet/constraints.hpp"
+#include "verlet/composite.hpp"
+#include "simulation/object_pool.hpp"
+
+
+namespace simulation
+{
+    // Binary image of an ObjectPool. A header and a section table are followed by the sections, each a
+    // plain array at a SNAPSHOT_ALIGNMENT aligned offset: the particle arrays, the composites (index ranges
+    // into the other arrays) and the packed array of every constraint kind (constraints refer to particles
+    // by index). Everything is in host byte order, so a mapped file is used in place: SnapshotView
+    // only checks the header and hands out pointers into the mapping.
+    //
+    // Files are only readable by a pool with the same scalar type and constraint kinds; the version is
+    // bumped whenever the layout changes.
+    static const uint32_t SNAPSHOT_VERSION = 3;
+    static const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+    static const uint64_t SNAPSHOT_ALIGNMENT = 64;
+
+    enum SnapshotSectionId
+    {
+        SNAPSHOT_X = 0,
+        SNAPSHOT_Y,
+        SNAPSHOT_LAST_X,
+        SNAPSHOT_LAST_Y,
+        SNAPSHOT_RADIUS,
+        SNAPSHOT_INVERSE_MASS,
+        SNAPSHOT_COMPOSITES,
+        // then the constraints of each kind, in kind id order
+        SNAPSHOT_CONSTRAINTS
+    };
+
+    struct SnapshotHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint32_t scalar_size;
+        uint32_t kind_count;
+        uint32_t section_count;
+        uint32_t particle_count;
+        uint32_t composite_count;
+        uint32_t reserved;
+        uint64_t file_size;
+    };
+
+    struct SnapshotSection
+    {
+        uint32_t id;
+        uint32_t element_size;
+        uint64_t offset;
+        uint64_t count;
+    };
+
+    static const char SNAPSHOT_MAGIC[8] = {'V', 'E', 'R', 'L', 'E', 'T', 'S', 'N'};
+
+
+    // Read only mapping of a whole file, unmapped when destroyed
+    class MappedFile
+    {
+        const char* _data;
+        size_t _size;
+
+    public:
+        MappedFile() : _data(nullptr), _size(0)
+        {
+        }
+
+        ~MappedFile()
+        {
+            Close();
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool Open(const char* path)
+        {
+            Close();
+            int file = open(path, O_RDONLY);
+            if (file < 0)
+            {
+                return false;
+            }
+            struct stat status;
+            if (fstat(file, &status) != 0 || status.st_size <= 0)
+            {
+                close(file);
+                return false;
+            }
+            void* address = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+            close(file);
+            if (address == MAP_FAILED)
+            {
+                return false;
+            }
+            _data = static_cast<const char*>(address);
+            _size = status.st_size;
+            return true;
+        }
+
+        void Close()
+        {
+            if (_data != nullptr)
+            {
+                munmap(const_cast<char*>(_data), _size);
+                _data = nullptr;
+                _size = 0;
+            }
+        }
+
+        const char* data() const
+        {
+            return _data;
+        }
+
+        size_t size() const
+        {
+            return _size;
+        }
+    };
+
+
+    template <class T, class... Extra>
+    class SnapshotView
+    {
+        static_assert(std::is_floating_point<T>::value,
+              "SnapshotView can be of floating point data types only");
+
+        typedef ObjectPool<T, Extra...> Pool;
+        static const int KIND_COUNT = 3 + sizeof...(Extra);
+
+        MappedFile _file;
+        const SnapshotHeader* _header;
+        const SnapshotSection* _sections;
+
+        template <class E>
+        const E* Section(int id, uint64_t* count = nullptr) const
+        {
+            const SnapshotSection& section = _sections[id];
+            if (count != nullptr)
+            {
+                *count = section.count;
+            }
+            return reinterpret_cast<const E*>(_file.data() + section.offset);
+        }
+
+        static bool RangeWithin(const IndexRange& range, uint64_t limit)
+        {
+            return range.first >= 0 && range.count >= 0 && (uint64_t) range.first + range.count <= limit;
+        }
+
+        // Composite ranges must stay inside the arrays they refer to, and be empty for kinds the pool does
+        // not have
+        bool ValidateComposites() const
+        {
+            uint64_t count;
+            const Composite<T>* composites = Section<Composite<T> >(SNAPSHOT_COMPOSITES, &count);
+            if (count != _header->composite_count)
+            {
+                return false;
+            }
+            for (uint64_t c = 0; c < count; ++c)
+            {
+                if (!RangeWithin(composites[c].particles(), _header->particle_count))
+                {
+                    return false;
+                }
+                for (int kind = 0; kind < MAX_CONSTRAINT_KINDS; ++kind)
+                {
+                    uint64_t limit = (kind < KIND_COUNT) ? _sections[SNAPSHOT_CONSTRAINTS + kind].count : 0;
+                    if (!RangeWithin(composites[c].constraints(kind), limit))
+                    {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        // Constraints may only refer to particles of the snapshot
+        template <class Kind>
+        bool ValidateConstraints() const
+        {
+            int count;
+            const Kind* constraints = Constraints<Kind>(&count);
+            bool valid = true;
+            for (int c = 0; c < count; ++c)
+            {
+                constraints[c].ForEachParticle([&](int particle) {
+                    valid = valid && (particle >= 0) && (particle < (int) _header->particle_count);
+                });
+            }
+            return valid;
+        }
+
+        // Checks that every section holds whole elements of the expected size inside the file and that every
+        // index stays inside the arrays it refers to, so a damaged file cannot send the solver out of bounds
+        bool Validate() const
+        {
+            static const uint32_t particle_sizes[SNAPSHOT_CONSTRAINTS] = {sizeof(T), sizeof(T), sizeof(T),
+                sizeof(T), sizeof(T), sizeof(T), sizeof(Composite<T>)};
+            const uint32_t kind_sizes[] = {sizeof(PinConstraint<T>), sizeof(DistanceConstraint<T>),
+                sizeof(AngularConstraint<T>), sizeof(Extra)...};
+
+            for (uint32_t s = 0; s < _header->section_count; ++s)
+            {
+                const SnapshotSection& section = _sections[s];
+                uint32_t expected = (s < SNAPSHOT_CONSTRAINTS) ? particle_sizes[s]
+                    : kind_sizes[s - SNAPSHOT_CONSTRAINTS];
+                if (section.id != s || section.element_size != expected || section.offset % SNAPSHOT_ALIGNMENT != 0
+                    || section.offset > _file.size()
+                    || section.count > (_file.size() - section.offset) / section.element_size)
+                {
+                    return false;
+                }
+            }
+
+            for (int s = SNAPSHOT_X; s <= SNAPSHOT_INVERSE_MASS; ++s)
+            {
+                if (_sections[s].count != _header->particle_count)
+                {
+                    return false;
+                }
+            }
+            if (!ValidateComposites())
+            {
+                return false;
+            }
+            bool valid[] = {ValidateConstraints<PinConstraint<T> >(), ValidateConstraints<DistanceConstraint<T> >(),
+                ValidateConstraints<AngularConstraint<T> >(), ValidateConstraints<Extra>()...};
+            for (int kind = 0; kind < KIND_COUNT; ++kind)
+            {
+                if (!valid[kind])
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+    public:
+        SnapshotView() : _header(nullptr), _sections(nullptr)
+        {
+        }
+
+        // Maps the file and checks that this pool type can read it and that its indices are in range.
+        // Nothing is copied.
+        bool Open(const char* path)
+        {
+            _header = nullptr;
+            if (!_file.Open(path) || _file.size() < sizeof(SnapshotHeader))
+            {
+                return false;
+            }
+            const SnapshotHeader* header = reinterpret_cast<const SnapshotHeader*>(_file.data());
+            const uint32_t section_count = SNAPSHOT_CONSTRAINTS + KIND_COUNT;
+            if (std::memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0
+                || header->version != SNAPSHOT_VERSION || header->byte_order != SNAPSHOT_BYTE_ORDER
+                || header->scalar_size != sizeof(T) || header->kind_count != (uint32_t) KIND_COUNT
+                || header->section_count != section_count || header->file_size != _file.size()
+                || _file.size() < sizeof(SnapshotHeader) + section_count * sizeof(SnapshotSection))
+            {
+                _file.Close();
+                return false;
+            }
+            _header = header;
+            _sections = reinterpret_cast<const SnapshotSection*>(_file.data() + sizeof(SnapshotHeader));
+            if (!Validate())
+            {
+                _header = nullptr;
+                _file.Close();
+                return false;
+            }
+            return true;
+        }
+
+        bool is_open() const
+        {
+            return _header != nullptr;
+        }
+
+        int particle_count() const
+        {
+            return _header->particle_count;
+        }
+
+        int composite_count() const
+        {
+            return _header->composite_count;
+        }
+
+        // Particle arrays in the layout of ParticleArrays, pointing into the mapping
+        const T* x() const { return Section<T>(SNAPSHOT_X); }
+        const T* y() const { return Section<T>(SNAPSHOT_Y); }
+        const T* last_x() const { return Section<T>(SNAPSHOT_LAST_X); }
+        const T* last_y() const { return Section<T>(SNAPSHOT_LAST_Y); }
+        const T* radius() const { return Section<T>(SNAPSHOT_RADIUS); }
+        const T* inverse_mass() const { return Section<T>(SNAPSHOT_INVERSE_MASS); }
+
+        template <class Kind>
+        const Kind* Constraints(int* count) const
+        {
+            uint64_t section_count;
+            const Kind* constraints = Section<Kind>(SNAPSHOT_CONSTRAINTS + Pool::template KindId<Kind>(),
+                &section_count);
+            *count = (int) section_count;
+            return constraints;
+        }
+
+        const Composite<T>* composites() const
+        {
+            return Section<Composite<T> >(SNAPSHOT_COMPOSITES);
+        }
+    };
+
+
+    namespace snapshot_detail
+    {
+        // Collects the sections of a pool in file order, pointing at the pool's own memory
+        template <class T>
+        struct SectionList
+        {
+            std::vector<SnapshotSection> sections;
+            std::vector<const void*> data;
+
+            void Add(uint32_t element_size, const void* elements, uint64_t count)
+            {
+                SnapshotSection section = {(uint32_t) sections.size(), element_size, 0, count};
+                sections.push_back(section);
+                data.push_back(elements);
+            }
+        };
+
+        template <class T>
+        struct AddConstraintSections
+        {
+            SectionList<T>& list;
+
+            template <class Kind>
+            void operator()(const Kind* constraints, int count) const
+            {
+                static_assert(std::is_trivially_copyable<Kind>::value,
+                    "Constraint kinds must be trivially copyable to be snapshotted");
+                list.Add(sizeof(Kind), constraints, count);
+            }
+        };
+
+        template <class T, class... Extra>
+        struct RestoreConstraints
+        {
+            const SnapshotView<T, Extra...>& view;
+            ObjectPool<T, Extra...>& pool;
+
+            template <class Kind>
+            bool Fits() const
+            {
+                int count;
+                view.template Constraints<Kind>(&count);
+                return pool.template CanAllocateConstraints<Kind>(count);
+            }
+
+            template <class Kind>
+            void Copy() const
+            {
+                int count;
+                const Kind* constraints = view.template Constraints<Kind>(&count);
+                if (count > 0)
+                {
+                    std::memcpy(pool.template AllocateConstraints<Kind>(count), constraints, count * sizeof(Kind));
+                }
+            }
+        };
+    }
+
+
+    // Writes the pool to path through a temporary file renamed over it, so a crash while saving leaves the
+    // previous snapshot intact. Returns false if the file cannot be written.
+    template <class T, class... Extra>
+    bool SaveSnapshot(const ObjectPool<T, Extra...>& pool, const char* path)
+    {
+        const int kind_count = 3 + sizeof...(Extra);
+
+        const ParticleArrays<T>& particles = pool.particles;
+        const uint64_t particle_count = pool.particle_count;
+        snapshot_detail::SectionList<T> list;
+        list.Add(sizeof(T), particles.x, particle_count);
+        list.Add(sizeof(T), particles.y, particle_count);
+        list.Add(sizeof(T), particles.last_x, particle_count);
+        list.Add(sizeof(T), particles.last_y, particle_count);
+        list.Add(sizeof(T), particles.radius, particle_count);
+        list.Add(sizeof(T), particles.inverse_mass, particle_count);
+        list.Add(sizeof(Composite<T>), pool.composites, pool.composite_count);
+        snapshot_detail::AddConstraintSections<T> add_constraints = {list};
+        pool.VisitConstraints(add_constraints);
+
+        SnapshotHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        header.version = SNAPSHOT_VERSION;
+        header.byte_order = SNAPSHOT_BYTE_ORDER;
+        header.scalar_size = sizeof(T);
+        header.kind_count = kind_count;
+        header.section_count = (uint32_t) list.sections.size();
+        header.particle_count = pool.particle_count;
+        header.composite_count = pool.composite_count;
+
+        uint64_t offset = sizeof(SnapshotHeader) + list.sections.size() * sizeof(SnapshotSection);
+        for (auto it = list.sections.begin(); it != list.sections.end(); ++it)
+        {
+            offset = (offset + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+            it->offset = offset;
+            offset += it->element_size * it->count;
+        }
+        header.file_size = offset;
+
+        std::string temporary_path = std::string(path) + ".tmp";
+        std::FILE* file = std::fopen(temporary_path.c_str(), "wb");
+        if (file == nullptr)
+        {
+            return false;
+        }
+        bool written = (std::fwrite(&header, sizeof(header), 1, file) == 1)
+            && (std::fwrite(list.sections.data(), sizeof(SnapshotSection), list.sections.size(), file)
+                == list.sections.size());
+        static const char padding[SNAPSHOT_ALIGNMENT] = {0};
+        for (size_t s = 0; written && s < list.sections.size(); ++s)
+        {
+            const SnapshotSection& section = list.sections[s];
+            size_t gap = section.offset - (uint64_t) std::ftell(file);
+            size_t bytes = section.element_size * section.count;
+            written = (gap == 0 || std::fwrite(padding, gap, 1, file) == 1)
+                && (bytes == 0 || std::fwrite(list.data[s], bytes, 1, file) == 1);
+        }
+        written = (std::fclose(file) == 0) && written;
+        if (!written || std::rename(temporary_path.c_str(), path) != 0)
+        {
+            std::remove(temporary_path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Fills an empty pool from a snapshot, every array is copied as it is. Returns false if the pool is not
+    // empty or too small for the snapshot.
+    template <class T, class... Extra>
+    bool RestoreSnapshot(const SnapshotView<T, Extra...>& view, ObjectPool<T, Extra...>& pool)
+    {
+        snapshot_detail::RestoreConstraints<T, Extra...> restore = {view, pool};
+
+        if (!view.is_open() || pool.particle_count != 0 || pool.composite_count != 0
+            || pool.pin_constraints_count != 0 || pool.distance_constraints_count != 0
+            || pool.angular_constraints_count != 0)
+        {
+            return false;
+        }
+        bool fits = pool.CanAllocate(view.particle_count(), 0, 0, 0, view.composite_count())
+            && restore.template Fits<PinConstraint<T> >() && restore.template Fits<DistanceConstraint<T> >()
+            && restore.template Fits<AngularConstraint<T> >();
+        bool extra_fits[] = {true, restore.template Fits<Extra>()...};
+        for (size_t k = 0; k < sizeof(extra_fits) / sizeof(extra_fits[0]); ++k)
+        {
+            fits = fits && extra_fits[k];
+        }
+        if (!fits)
+        {
+            return false;
+        }
+
+        const int particle_count = view.particle_count();
+        if (particle_count > 0)
+        {
+            pool.AllocateParticles(particle_count);
+            const ParticleArrays<T>& particles = pool.particles;
+            std::memcpy(particles.x, view.x(), particle_count * sizeof(T));
+            std::memcpy(particles.y, view.y(), particle_count * sizeof(T));
+            std::memcpy(particles.last_x, view.last_x(), particle_count * sizeof(T));
+            std::memcpy(particles.last_y, view.last_y(), particle_count * sizeof(T));
+            std::memcpy(particles.radius, view.radius(), particle_count * sizeof(T));
+            std::memcpy(particles.inverse_mass, view.inverse_mass(), particle_count * sizeof(T));
+        }
+
+        restore.template Copy<PinConstraint<T> >();
+        restore.template Copy<DistanceConstraint<T> >();
+        restore.template Copy<AngularConstraint<T> >();
+        int expand[] = {0, (restore.template Copy<Extra>(), 0)...};
+        (void) expand;
+
+        const int composite_count = view.composite_count();
+        if (composite_count > 0)
+        {
+            std::memcpy(pool.AllocateComposites(composite_count), view.composites(),
+                composite_count * sizeof(Composite<T>));
+        }
+        return true;
+    }
+}
+
+#endif /* defined(____snapshot__) */
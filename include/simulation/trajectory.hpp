@@ -0,0 +1,556 @@
+
+#ifndef ____trajectory__
+#define ____trajectory__
+
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "verlet/particle.hpp"
+
+
+namespace simulation
+{
+    // Trajectory files hold the particle positions of every recorded frame. Positions are quantized to
+    // multiples of a quantum, which bounds the error of every frame by half a quantum, and grouped in
+    // chunks of up to keyframe_interval frames:
+    //
+    //     TrajectoryHeader
+    //     chunk: TrajectoryChunkHeader, frame times, keyframe, delta frames
+    //     ...
+    //     chunk index: one TrajectoryIndexEntry per chunk
+    //
+    // A keyframe stores the quantized x then y of every particle as int32. A delta frame stores, for every
+    // coordinate, the difference to the value predicted from the frames before it in the chunk (the last
+    // value for the first delta, a constant velocity extrapolation after that) as a zigzag varint, which is
+    // one byte for anything moving steadily. Deltas are taken between quantized values, so decoding is exact
+    // and error does not build up along a chunk. A chunk also ends whenever the particle count changes.
+    //
+    // The index is written on Close. A file whose writer never closed it is still readable: the reader then
+    // walks the chunk headers and stops at the first incomplete chunk.
+    static const uint32_t TRAJECTORY_VERSION = 1;
+    static const char TRAJECTORY_MAGIC[8] = {'V', 'E', 'R', 'L', 'E', 'T', 'T', 'R'};
+    static const uint32_t TRAJECTORY_CHUNK_MAGIC = 0x4B484354;
+
+    struct TrajectoryHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t keyframe_interval;
+        double quantum;
+        // filled in by Close, 0 until then
+        uint64_t index_offset;
+        uint64_t chunk_count;
+        uint64_t frame_count;
+    };
+
+    struct TrajectoryChunkHeader
+    {
+        uint32_t magic;
+        uint32_t frame_count;
+        uint64_t first_frame;
+        uint32_t particle_count;
+        uint32_t reserved;
+        // bytes of chunk data following this header
+        uint64_t size;
+    };
+
+    struct TrajectoryIndexEntry
+    {
+        uint64_t first_frame;
+        uint64_t offset;
+        uint32_t frame_count;
+        uint32_t particle_count;
+    };
+
+
+    namespace trajectory_detail
+    {
+        inline int32_t Quantize(float value, double inverse_quantum)
+        {
+            double scaled = std::floor(value * inverse_quantum + 0.5);
+            scaled = std::min(std::max(scaled, (double) INT32_MIN), (double) INT32_MAX);
+            return (int32_t) scaled;
+        }
+
+        // Value the delta of a coordinate is taken against, from its two previous quantized values
+        inline int32_t Predict(int32_t last, int32_t before_last, bool extrapolate)
+        {
+            return extrapolate ? (int32_t) (2 * (int64_t) last - before_last) : last;
+        }
+
+        inline void PutVarint(std::vector<uint8_t>& out, int64_t value)
+        {
+            uint64_t zigzag = ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+            while (zigzag >= 0x80)
+            {
+                out.push_back((uint8_t) (zigzag | 0x80));
+                zigzag >>= 7;
+            }
+            out.push_back((uint8_t) zigzag);
+        }
+
+        // Returns false when the data ends before the varint does
+        inline bool GetVarint(const uint8_t*& in, const uint8_t* end, int64_t& value)
+        {
+            uint64_t zigzag = 0;
+            for (int shift = 0; shift < 64; shift += 7)
+            {
+                if (in == end)
+                {
+                    return false;
+                }
+                uint8_t byte = *in++;
+                zigzag |= (uint64_t) (byte & 0x7F) << shift;
+                if ((byte & 0x80) == 0)
+                {
+                    value = (int64_t) (zigzag >> 1) ^ -(int64_t) (zigzag & 1);
+                    return true;
+                }
+            }
+            return false;
+        }
+    }
+
+
+    // Records frames of particle positions to a trajectory file. Record only copies the positions into a
+    // ring of frame slots; a background thread quantizes, encodes and writes them, so the simulation thread
+    // only waits when the writer falls a whole ring behind.
+    class TrajectoryWriter
+    {
+        struct Frame
+        {
+            std::vector<float> x;
+            std::vector<float> y;
+            double time;
+        };
+
+        static const int RING_SIZE = 8;
+
+        std::FILE* _file;
+        TrajectoryHeader _header;
+        double _inverse_quantum;
+
+        // ring of frames between Record and the writer thread
+        Frame _ring[RING_SIZE];
+        uint64_t _recorded;
+        uint64_t _written;
+        bool _closing;
+        std::mutex _mutex;
+        std::condition_variable _frame_ready;
+        std::condition_variable _slot_free;
+        std::thread _thread;
+
+        // writer thread state: the chunk being encoded and the last two quantized frames of it
+        TrajectoryChunkHeader _chunk;
+        std::vector<double> _chunk_times;
+        std::vector<uint8_t> _chunk_data;
+        std::vector<int32_t> _last;
+        std::vector<int32_t> _before_last;
+        std::vector<TrajectoryIndexEntry> _index;
+        bool _failed;
+
+        void Write(const void* data, size_t bytes)
+        {
+            _failed = _failed || (bytes > 0 && std::fwrite(data, bytes, 1, _file) != 1);
+        }
+
+        void FlushChunk()
+        {
+            if (_chunk.frame_count == 0)
+            {
+                return;
+            }
+            TrajectoryIndexEntry entry = {_chunk.first_frame, (uint64_t) std::ftell(_file), _chunk.frame_count,
+                _chunk.particle_count};
+            _index.push_back(entry);
+
+            _chunk.size = _chunk_times.size() * sizeof(double) + _chunk_data.size();
+            Write(&_chunk, sizeof(_chunk));
+            Write(_chunk_times.data(), _chunk_times.size() * sizeof(double));
+            Write(_chunk_data.data(), _chunk_data.size());
+
+            _chunk.first_frame += _chunk.frame_count;
+            _chunk.frame_count = 0;
+            _chunk_times.clear();
+            _chunk_data.clear();
+        }
+
+        void Encode(const Frame& frame)
+        {
+            using namespace trajectory_detail;
+
+            const uint32_t particle_count = (uint32_t) frame.x.size();
+            if (_chunk.frame_count == _header.keyframe_interval || (_chunk.frame_count > 0
+                && particle_count != _chunk.particle_count))
+            {
+                FlushChunk();
+            }
+
+            // x of every particle, then y
+            const size_t count = 2 * (size_t) particle_count;
+            if (_chunk.frame_count == 0)
+            {
+                _chunk.particle_count = particle_count;
+                _last.resize(count);
+                _before_last.resize(count);
+                for (size_t i = 0; i < count; ++i)
+                {
+                    float value = (i < particle_count) ? frame.x[i] : frame.y[i - particle_count];
+                    _last[i] = Quantize(value, _inverse_quantum);
+                }
+                _chunk_data.insert(_chunk_data.end(), reinterpret_cast<const uint8_t*>(_last.data()),
+                    reinterpret_cast<const uint8_t*>(_last.data() + count));
+            }
+            else
+            {
+                const bool extrapolate = (_chunk.frame_count >= 2);
+                for (size_t i = 0; i < count; ++i)
+                {
+                    float value = (i < particle_count) ? frame.x[i] : frame.y[i - particle_count];
+                    int32_t quantized = Quantize(value, _inverse_quantum);
+                    PutVarint(_chunk_data, (int64_t) quantized - Predict(_last[i], _before_last[i], extrapolate));
+                    _before_last[i] = _last[i];
+                    _last[i] = quantized;
+                }
+            }
+            _chunk_times.push_back(frame.time);
+            ++_chunk.frame_count;
+        }
+
+        void WriterLoop()
+        {
+            for (;;)
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _frame_ready.wait(lock, [this]() { return _written < _recorded || _closing; });
+                if (_written == _recorded)
+                {
+                    return;
+                }
+                const Frame& frame = _ring[_written % RING_SIZE];
+                lock.unlock();
+
+                // the slot stays with this thread until _written moves past it
+                Encode(frame);
+
+                lock.lock();
+                ++_written;
+                _slot_free.notify_one();
+            }
+        }
+
+    public:
+        TrajectoryWriter() : _file(nullptr), _inverse_quantum(1), _recorded(0), _written(0), _closing(false),
+            _failed(false)
+        {
+        }
+
+        ~TrajectoryWriter()
+        {
+            Close();
+        }
+
+        TrajectoryWriter(const TrajectoryWriter&) = delete;
+        TrajectoryWriter& operator=(const TrajectoryWriter&) = delete;
+
+        bool is_open() const
+        {
+            return _file != nullptr;
+        }
+
+        // Starts a new trajectory file. Positions are stored to within quantum / 2, with a keyframe every
+        // keyframe_interval frames; longer intervals compress better and seek slower.
+        bool Open(const char* path, float quantum, int keyframe_interval)
+        {
+            Close();
+            _file = std::fopen(path, "wb");
+            if (_file == nullptr)
+            {
+                return false;
+            }
+
+            std::memset(&_header, 0, sizeof(_header));
+            std::memcpy(_header.magic, TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC));
+            _header.version = TRAJECTORY_VERSION;
+            _header.keyframe_interval = std::max(1, keyframe_interval);
+            _header.quantum = quantum;
+            _inverse_quantum = 1.0 / quantum;
+
+            std::memset(&_chunk, 0, sizeof(_chunk));
+            _chunk.magic = TRAJECTORY_CHUNK_MAGIC;
+            _index.clear();
+            _recorded = 0;
+            _written = 0;
+            _closing = false;
+            _failed = false;
+            Write(&_header, sizeof(_header));
+
+            _thread = std::thread(&TrajectoryWriter::WriterLoop, this);
+            return true;
+        }
+
+        // Queues the positions of the first particle_count particles as the frame at time
+        void Record(const verlet::ParticleArrays<float>& particles, int particle_count, double time)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _slot_free.wait(lock, [this]() { return _recorded - _written < (uint64_t) RING_SIZE; });
+            Frame& frame = _ring[_recorded % RING_SIZE];
+            lock.unlock();
+
+            frame.x.assign(particles.x, particles.x + particle_count);
+            frame.y.assign(particles.y, particles.y + particle_count);
+            frame.time = time;
+
+            lock.lock();
+            ++_recorded;
+            _frame_ready.notify_one();
+        }
+
+        // Writes the queued frames, the last chunk and the index. Returns false if any write failed.
+        bool Close()
+        {
+            if (_file == nullptr)
+            {
+                return false;
+            }
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _closing = true;
+            }
+            _frame_ready.notify_one();
+            _thread.join();
+
+            FlushChunk();
+            _header.index_offset = (uint64_t) std::ftell(_file);
+            _header.chunk_count = _index.size();
+            _header.frame_count = _chunk.first_frame;
+            Write(_index.data(), _index.size() * sizeof(TrajectoryIndexEntry));
+            _failed = _failed || std::fseek(_file, 0, SEEK_SET) != 0;
+            Write(&_header, sizeof(_header));
+            _failed = (std::fclose(_file) != 0) || _failed;
+            _file = nullptr;
+            return !_failed;
+        }
+    };
+
+
+    // Random access to the frames of a trajectory file. Seeking goes through the chunk index to the
+    // keyframe at or before the frame; reading the frames of a chunk in order decodes each delta once.
+    class TrajectoryReader
+    {
+        std::FILE* _file;
+        TrajectoryHeader _header;
+        std::vector<TrajectoryIndexEntry> _index;
+
+        // chunk currently decoded, and the frame of it the decoder is at
+        int _chunk;
+        std::vector<double> _chunk_times;
+        std::vector<uint8_t> _chunk_data;
+        uint64_t _frame;
+        const uint8_t* _cursor;
+        std::vector<int32_t> _last;
+        std::vector<int32_t> _before_last;
+
+        // Builds the index from the chunk headers, for files whose writer did not get to Close
+        void ScanChunks(long file_size)
+        {
+            uint64_t offset = sizeof(TrajectoryHeader);
+            uint64_t frame = 0;
+            TrajectoryChunkHeader chunk;
+            while (std::fseek(_file, (long) offset, SEEK_SET) == 0 && std::fread(&chunk, sizeof(chunk), 1, _file) == 1
+                && chunk.magic == TRAJECTORY_CHUNK_MAGIC && chunk.first_frame == frame
+                && offset + sizeof(chunk) + chunk.size <= (uint64_t) file_size)
+            {
+                TrajectoryIndexEntry entry = {chunk.first_frame, offset, chunk.frame_count, chunk.particle_count};
+                _index.push_back(entry);
+                offset += sizeof(chunk) + chunk.size;
+                frame += chunk.frame_count;
+            }
+            _header.frame_count = frame;
+        }
+
+        bool LoadChunk(int chunk)
+        {
+            const TrajectoryIndexEntry& entry = _index[chunk];
+            TrajectoryChunkHeader header;
+            if (std::fseek(_file, (long) entry.offset, SEEK_SET) != 0
+                || std::fread(&header, sizeof(header), 1, _file) != 1 || header.magic != TRAJECTORY_CHUNK_MAGIC
+                || header.frame_count != entry.frame_count
+                || header.size < header.frame_count * sizeof(double) + 2 * sizeof(int32_t) * header.particle_count)
+            {
+                return false;
+            }
+            _chunk_times.resize(header.frame_count);
+            _chunk_data.resize(header.size - header.frame_count * sizeof(double));
+            if (std::fread(_chunk_times.data(), sizeof(double), header.frame_count, _file) != header.frame_count
+                || (!_chunk_data.empty() && std::fread(_chunk_data.data(), _chunk_data.size(), 1, _file) != 1))
+            {
+                return false;
+            }
+            _chunk = chunk;
+            _frame = entry.first_frame;
+
+            // the keyframe
+            const size_t count = 2 * (size_t) header.particle_count;
+            _last.resize(count);
+            _before_last.resize(count);
+            std::memcpy(_last.data(), _chunk_data.data(), count * sizeof(int32_t));
+            _cursor = _chunk_data.data() + count * sizeof(int32_t);
+            return true;
+        }
+
+        bool DecodeNext()
+        {
+            using namespace trajectory_detail;
+
+            const bool extrapolate = (_frame - _index[_chunk].first_frame >= 1);
+            const uint8_t* end = _chunk_data.data() + _chunk_data.size();
+            for (size_t i = 0; i < _last.size(); ++i)
+            {
+                int64_t delta;
+                if (!GetVarint(_cursor, end, delta))
+                {
+                    return false;
+                }
+                int32_t value = (int32_t) (Predict(_last[i], _before_last[i], extrapolate) + delta);
+                _before_last[i] = _last[i];
+                _last[i] = value;
+            }
+            ++_frame;
+            return true;
+        }
+
+    public:
+        TrajectoryReader() : _file(nullptr), _chunk(-1), _frame(0), _cursor(nullptr)
+        {
+            std::memset(&_header, 0, sizeof(_header));
+        }
+
+        ~TrajectoryReader()
+        {
+            Close();
+        }
+
+        TrajectoryReader(const TrajectoryReader&) = delete;
+        TrajectoryReader& operator=(const TrajectoryReader&) = delete;
+
+        bool Open(const char* path)
+        {
+            Close();
+            _file = std::fopen(path, "rb");
+            if (_file == nullptr)
+            {
+                return false;
+            }
+            std::fseek(_file, 0, SEEK_END);
+            long file_size = std::ftell(_file);
+            std::fseek(_file, 0, SEEK_SET);
+            std::memset(&_header, 0, sizeof(_header));
+            if (std::fread(&_header, sizeof(_header), 1, _file) != 1
+                || std::memcmp(_header.magic, TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC)) != 0
+                || _header.version != TRAJECTORY_VERSION || !(_header.quantum > 0))
+            {
+                Close();
+                return false;
+            }
+
+            _index.clear();
+            if (_header.index_offset != 0
+                && _header.index_offset + _header.chunk_count * sizeof(TrajectoryIndexEntry) <= (uint64_t) file_size)
+            {
+                _index.resize(_header.chunk_count);
+                if (_header.chunk_count > 0 && (std::fseek(_file, (long) _header.index_offset, SEEK_SET) != 0
+                    || std::fread(_index.data(), sizeof(TrajectoryIndexEntry), _index.size(), _file) != _index.size()))
+                {
+                    Close();
+                    return false;
+                }
+            }
+            else
+            {
+                ScanChunks(file_size);
+            }
+            _chunk = -1;
+            return true;
+        }
+
+        void Close()
+        {
+            if (_file != nullptr)
+            {
+                std::fclose(_file);
+                _file = nullptr;
+            }
+            _index.clear();
+            _chunk = -1;
+        }
+
+        int frame_count() const
+        {
+            return (int) _header.frame_count;
+        }
+
+        float quantum() const
+        {
+            return (float) _header.quantum;
+        }
+
+        // Decodes a frame into x and y, resized to its particle count, and its time. Reading frames in
+        // increasing order within a chunk continues from the last one read instead of from the keyframe.
+        // Returns false for frames outside the file or data that does not decode.
+        bool ReadFrame(int frame, std::vector<float>& x, std::vector<float>& y, double& time)
+        {
+            if (_file == nullptr || frame < 0 || frame >= frame_count())
+            {
+                return false;
+            }
+
+            // last chunk starting at or before the frame
+            auto it = std::upper_bound(_index.begin(), _index.end(), (uint64_t) frame,
+                [](uint64_t value, const TrajectoryIndexEntry& entry) { return value < entry.first_frame; });
+            int chunk = (int) (it - _index.begin()) - 1;
+            if (chunk < 0)
+            {
+                return false;
+            }
+            if (chunk != _chunk || (uint64_t) frame < _frame)
+            {
+                if (!LoadChunk(chunk))
+                {
+                    _chunk = -1;
+                    return false;
+                }
+            }
+            while (_frame < (uint64_t) frame)
+            {
+                if (!DecodeNext())
+                {
+                    _chunk = -1;
+                    return false;
+                }
+            }
+
+            const size_t particle_count = _last.size() / 2;
+            const double quantum = _header.quantum;
+            x.resize(particle_count);
+            y.resize(particle_count);
+            for (size_t p = 0; p < particle_count; ++p)
+            {
+                x[p] = (float) (_last[p] * quantum);
+                y[p] = (float) (_last[particle_count + p] * quantum);
+            }
+            time = _chunk_times[frame - _index[chunk].first_frame];
+            return true;
+        }
+    };
+}
+
+#endif /* defined(____trajectory__) */
@@ -0,0 +1,64 @@
+
+#ifndef ____triple_buffer__
+#define ____triple_buffer__
+
+
+#include <atomic>
+
+
+namespace simulation
+{
+    // Lock free hand over of values from one writer thread to one reader thread. The writer fills back()
+    // and publishes it, the reader takes the latest published value into front(). Each side owns one of
+    // the three slots and they swap through the third, so neither ever waits for the other; values
+    // published faster than the reader takes them are overwritten.
+    template <class T>
+    class TripleBuffer
+    {
+    private:
+        // set in _middle while the writer published a slot the reader has not taken yet
+        static const int FRESH = 4;
+
+        T _slots[3];
+        std::atomic<int> _middle;
+        int _back;
+        int _front;
+
+    public:
+        TripleBuffer() : _middle(1), _back(0), _front(2)
+        {
+        }
+
+        // Writer side. The slot stays valid until the next Publish.
+        T& back()
+        {
+            return _slots[_back];
+        }
+
+        // Writer side. Hands back() over to the reader and takes the slot it is not using.
+        void Publish()
+        {
+            _back = _middle.exchange(_back | FRESH, std::memory_order_acq_rel) & ~FRESH;
+        }
+
+        // Reader side. Takes the latest published value into front(), returns false if there is none newer
+        // than the current front().
+        bool Acquire()
+        {
+            if ((_middle.load(std::memory_order_relaxed) & FRESH) == 0)
+            {
+                return false;
+            }
+            _front = _middle.exchange(_front, std::memory_order_acq_rel) & ~FRESH;
+            return true;
+        }
+
+        // Reader side. The slot stays valid until the next Acquire.
+        const T& front() const
+        {
+            return _slots[_front];
+        }
+    };
+}
+
+#endif /* defined(____triple_buffer__) */
@@ -0,0 +1,99 @@
+
+#ifndef ____world__
+#define ____world__
+
+
+#include "math/vector2d.hpp"
+#include "simulation/object_pool.hpp"
+#include "simulation/trajectory.hpp"
+#include "verlet/collision.hpp"
+#include "verlet/verlet.hpp"
+
+
+namespace simulation
+{
+    // The physics side of the demo: object pool, solver and the scene builders. It has no dependency on
+    // SDL, so it can be stepped on machines without a display.
+    class World
+    {
+    private:
+        float world_width;
+        float world_height;
+
+        simulation::ObjectPool<float>* object_pool;
+        verlet::Verlet<float>* verlet;
+
+        // particle held by Grab, -1 for none, and where it is held
+        int grabbed_particle;
+        math::Vector2d<float> grab_target;
+        // only built by Grab when the collision grid cannot answer the query, and then at most once per step
+        verlet::SpatialGrid<float> pick_grid;
+        bool pick_grid_stale;
+
+        // seconds simulated so far, the time of recorded frames
+        double simulated_time;
+        TrajectoryWriter recorder;
+
+        static simulation::ObjectPool<float>* NewPool();
+    public:
+        World();
+        ~World();
+
+        float width() const
+        {
+            return world_width;
+        }
+
+        float height() const
+        {
+            return world_height;
+        }
+
+        const simulation::ObjectPool<float>& pool() const
+        {
+            return *object_pool;
+        }
+
+        verlet::Verlet<float>& solver()
+        {
+            return *verlet;
+        }
+
+        // rope, polygon, tire and cloth
+        bool CreateDemoScene();
+        // Adds the objects of a scene file, see simulation/scene.hpp, and switches the solver to its
+        // distance_mode if it has one. Returns false, changing nothing, if the file cannot be read, is not a
+        // valid scene or does not fit in the pool.
+        bool LoadScene(const char* path);
+
+        // Writes the pool to a snapshot file, see simulation/snapshot.hpp
+        bool SaveSnapshot(const char* path) const;
+        // Records the particle positions after every Update that took a step to a trajectory file, see
+        // simulation/trajectory.hpp, until StopRecording
+        bool StartRecording(const char* path, float quantum, int keyframe_interval);
+        bool StopRecording();
+
+        // Replaces the scene with the one saved in a snapshot file. Returns false, leaving the world as it
+        // was, if the file cannot be read by this world or does not fit in its pool.
+        bool LoadSnapshot(const char* path);
+
+        // Advances the world by frame_time seconds in fixed solver steps, returns the number of steps taken
+        int Update(float frame_time);
+
+        // Holds the particle nearest to position, within max_distance, at position until Release. Returns
+        // false if there is none. The lookup goes through the collision grid of the last step when it is
+        // fine enough, so it costs a few cells rather than a pass over the particles. Otherwise the first Grab
+        // after a step builds a pick grid that the later ones in the same step reuse.
+        bool Grab(const math::Vector2d<float>& position, float max_distance);
+        // Moves the held particle; it keeps the velocity of the move when released
+        void MoveGrab(const math::Vector2d<float>& position);
+        void Release();
+
+        int grabbed() const
+        {
+            return grabbed_particle;
+        }
+    };
+}
+
+#endif /* defined(____world__) */
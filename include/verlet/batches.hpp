@@ -0,0 +1,353 @@
+
+#ifndef ____batches__
+#define ____batches__
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "verlet/particle.hpp"
+#include "verlet/constraints.hpp"
+
+
+namespace verlet
+{
+    // Flat, index based copy of a run of distance constraints, as consumed by the relaxation kernels
+    template <class T>
+    struct DistanceBatchView
+    {
+        const int* particle1;
+        const int* particle2;
+        const T* distance_square;
+        // rest length, for the exact projection
+        const T* distance;
+        const T* stiffness;
+        // XPBD compliance, and the Lagrange multiplier accumulated over the iterations of a step
+        const T* compliance;
+        T* lambda;
+        // 1/dt^2 of the step, turning compliance into the time step scaled compliance of the projection
+        T compliance_scale;
+    };
+
+
+    template <class T>
+    struct AngularBatchView
+    {
+        const int* particle1;
+        const int* vertex;
+        const int* particle2;
+        const T* rest_cos;
+        const T* rest_sin;
+        const T* stiffness;
+        // XPBD compliance and multiplier, as for DistanceBatchView
+        const T* compliance;
+        T* lambda;
+        T compliance_scale;
+    };
+
+
+    // Constraint violation measured during one relaxation pass, as a share of the rest length of each
+    // constraint before it was corrected. Chunks relaxed in parallel each fill their own and merge them.
+    template <class T>
+    struct DistanceResidual
+    {
+        T max;
+        T sum_square;
+        int count;
+
+        DistanceResidual() : max(0), sum_square(0), count(0)
+        {
+        }
+
+        void Add(T violation)
+        {
+            violation = std::abs(violation);
+            max = std::max(max, violation);
+            sum_square += violation * violation;
+            ++count;
+        }
+
+        void Merge(const DistanceResidual& other)
+        {
+            max = std::max(max, other.max);
+            sum_square += other.sum_square;
+            count += other.count;
+        }
+
+        T rms() const
+        {
+            return (count > 0) ? std::sqrt(sum_square / count) : T(0);
+        }
+    };
+
+
+    static const int MAX_BATCH_COLORS = 64;
+
+    // Greedy graph coloring shared by the batch builders: gives each constraint for which include(constraint)
+    // is true the lowest color not yet taken by a constraint sharing a particle with it, MAX_BATCH_COLORS if
+    // there is none left, and -1 to the excluded ones. On return offsets[color] is where the color starts in
+    // the regrouped order and offsets[MAX_BATCH_COLORS + 1] the number of included constraints. Returns the
+    // number of colors used.
+    template <class C, class F>
+    int ColorConstraints(const C* constraints, int constraint_count, int particle_count, const F& include,
+        std::vector<int>& colors, std::vector<int>& offsets)
+    {
+        // colors already taken by a constraint touching each particle, one bit per color
+        std::vector<uint64_t> particle_colors(particle_count, 0);
+        colors.assign(constraint_count, -1);
+        offsets.assign(MAX_BATCH_COLORS + 2, 0);
+
+        for (int c = 0; c < constraint_count; ++c)
+        {
+            if (!include(constraints[c]))
+            {
+                continue;
+            }
+
+            uint64_t taken_colors = 0;
+            constraints[c].ForEachParticle([&](int particle) {
+                taken_colors |= particle_colors[particle];
+            });
+
+            int color = MAX_BATCH_COLORS;
+            if (~taken_colors != 0)
+            {
+                color = __builtin_ctzll(~taken_colors);
+                constraints[c].ForEachParticle([&](int particle) {
+                    particle_colors[particle] |= (uint64_t(1) << color);
+                });
+            }
+            colors[c] = color;
+            ++offsets[color + 1];
+        }
+
+        // greedy coloring always picks the lowest free color, so the used colors are 0..n-1
+        int used_colors = 0;
+        while (used_colors < MAX_BATCH_COLORS && offsets[used_colors + 1] > 0)
+        {
+            ++used_colors;
+        }
+        for (int color = 0; color <= MAX_BATCH_COLORS; ++color)
+        {
+            offsets[color + 1] += offsets[color];
+        }
+        return used_colors;
+    }
+
+
+    // Distance constraints regrouped by greedy graph coloring. No two constraints of the same color share
+    // a particle, so a color can be relaxed several lanes at a time (or by several threads) without
+    // changing the result. Constraints that would need more than MAX_COLORS colors are kept at the end
+    // and relaxed one after the other.
+    template <class T>
+    class DistanceBatches
+    {
+        static_assert(std::is_floating_point<T>::value,
+              "DistanceBatches can be of floating point data types only");
+
+        std::vector<int> _particle1;
+        std::vector<int> _particle2;
+        std::vector<T> _distance_square;
+        std::vector<T> _distance;
+        std::vector<T> _stiffness;
+        std::vector<T> _compliance;
+        std::vector<T> _lambda;
+        std::vector<int> _color_offsets;
+        int _serial_offset;
+
+    public:
+        static const int MAX_COLORS = MAX_BATCH_COLORS;
+
+        const std::vector<int>& color_offsets;
+        const int& serial_offset;
+
+        DistanceBatches() : _serial_offset(0), color_offsets(_color_offsets), serial_offset(_serial_offset)
+        {
+            _color_offsets.push_back(0);
+        }
+
+        int color_count() const
+        {
+            return (int) _color_offsets.size() - 1;
+        }
+
+        int constraint_count() const
+        {
+            return (int) _particle1.size();
+        }
+
+        DistanceBatchView<T> View()
+        {
+            DistanceBatchView<T> view;
+            view.particle1 = _particle1.data();
+            view.particle2 = _particle2.data();
+            view.distance_square = _distance_square.data();
+            view.distance = _distance.data();
+            view.stiffness = _stiffness.data();
+            view.compliance = _compliance.data();
+            view.lambda = _lambda.data();
+            view.compliance_scale = 1;
+            return view;
+        }
+
+        // XPBD multipliers start from 0 on every step
+        void ResetLambdas()
+        {
+            std::fill(_lambda.begin(), _lambda.end(), T(0));
+        }
+
+        void Build(const DistanceConstraint<T>* constraints, int constraint_count, int particle_count)
+        {
+            Build(constraints, constraint_count, particle_count, [](const DistanceConstraint<T>&) { return true; });
+        }
+
+        // Only keeps the constraints for which include(constraint) is true
+        template <class F>
+        void Build(const DistanceConstraint<T>* constraints, int constraint_count, int particle_count,
+            const F& include)
+        {
+            std::vector<int> colors;
+            std::vector<int> offsets;
+            int used_colors = ColorConstraints(constraints, constraint_count, particle_count, include, colors,
+                offsets);
+
+            int included_count = offsets[MAX_COLORS + 1];
+            _particle1.resize(included_count);
+            _particle2.resize(included_count);
+            _distance_square.resize(included_count);
+            _distance.resize(included_count);
+            _stiffness.resize(included_count);
+            _compliance.resize(included_count);
+            _lambda.assign(included_count, T(0));
+            for (int c = 0; c < constraint_count; ++c)
+            {
+                if (colors[c] < 0)
+                {
+                    continue;
+                }
+                int slot = offsets[colors[c]]++;
+                _particle1[slot] = constraints[c].particle1;
+                _particle2[slot] = constraints[c].particle2;
+                _compliance[slot] = constraints[c].compliance;
+                _distance_square[slot] = constraints[c].distance * constraints[c].distance;
+                _distance[slot] = constraints[c].distance;
+                _stiffness[slot] = constraints[c].stiffness;
+            }
+
+            // offsets[color] now holds the end of each color
+            _color_offsets.assign(1, 0);
+            for (int color = 0; color < used_colors; ++color)
+            {
+                _color_offsets.push_back(offsets[color]);
+            }
+            _serial_offset = _color_offsets.back();
+        }
+    };
+
+
+    // Angular constraints regrouped the same way as DistanceBatches, a color never touching a particle twice
+    template <class T>
+    class AngularBatches
+    {
+        static_assert(std::is_floating_point<T>::value,
+              "AngularBatches can be of floating point data types only");
+
+        std::vector<int> _particle1;
+        std::vector<int> _vertex;
+        std::vector<int> _particle2;
+        std::vector<T> _rest_cos;
+        std::vector<T> _rest_sin;
+        std::vector<T> _stiffness;
+        std::vector<T> _compliance;
+        std::vector<T> _lambda;
+        std::vector<int> _color_offsets;
+        int _serial_offset;
+
+    public:
+        const std::vector<int>& color_offsets;
+        const int& serial_offset;
+
+        AngularBatches() : _serial_offset(0), color_offsets(_color_offsets), serial_offset(_serial_offset)
+        {
+            _color_offsets.push_back(0);
+        }
+
+        int color_count() const
+        {
+            return (int) _color_offsets.size() - 1;
+        }
+
+        int constraint_count() const
+        {
+            return (int) _vertex.size();
+        }
+
+        AngularBatchView<T> View()
+        {
+            AngularBatchView<T> view;
+            view.particle1 = _particle1.data();
+            view.vertex = _vertex.data();
+            view.particle2 = _particle2.data();
+            view.rest_cos = _rest_cos.data();
+            view.rest_sin = _rest_sin.data();
+            view.stiffness = _stiffness.data();
+            view.compliance = _compliance.data();
+            view.lambda = _lambda.data();
+            view.compliance_scale = 1;
+            return view;
+        }
+
+        void ResetLambdas()
+        {
+            std::fill(_lambda.begin(), _lambda.end(), T(0));
+        }
+
+        // Only keeps the constraints for which include(constraint) is true
+        template <class F>
+        void Build(const AngularConstraint<T>* constraints, int constraint_count, int particle_count,
+            const F& include)
+        {
+            std::vector<int> colors;
+            std::vector<int> offsets;
+            int used_colors = ColorConstraints(constraints, constraint_count, particle_count, include, colors,
+                offsets);
+
+            int included_count = offsets[MAX_BATCH_COLORS + 1];
+            _particle1.resize(included_count);
+            _vertex.resize(included_count);
+            _particle2.resize(included_count);
+            _rest_cos.resize(included_count);
+            _rest_sin.resize(included_count);
+            _stiffness.resize(included_count);
+            _compliance.resize(included_count);
+            _lambda.assign(included_count, T(0));
+            for (int c = 0; c < constraint_count; ++c)
+            {
+                if (colors[c] < 0)
+                {
+                    continue;
+                }
+                int slot = offsets[colors[c]]++;
+                _particle1[slot] = constraints[c].particle1;
+                _vertex[slot] = constraints[c].vertex;
+                _particle2[slot] = constraints[c].particle2;
+                _rest_cos[slot] = constraints[c].rest_cos;
+                _rest_sin[slot] = constraints[c].rest_sin;
+                _stiffness[slot] = constraints[c].stiffness;
+                _compliance[slot] = constraints[c].compliance;
+            }
+
+            _color_offsets.assign(1, 0);
+            for (int color = 0; color < used_colors; ++color)
+            {
+                _color_offsets.push_back(offsets[color]);
+            }
+            _serial_offset = _color_offsets.back();
+        }
+    };
+}
+
+
+#endif /* defined(____batches__) */
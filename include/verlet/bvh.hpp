@@ -0,0 +1,287 @@
+
+#ifndef ____bvh__
+#define ____bvh__
+
+
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+
+
+namespace verlet
+{
+    template <class T>
+    struct Aabb
+    {
+        T min_x;
+        T min_y;
+        T max_x;
+        T max_y;
+
+        bool Overlaps(const Aabb<T>& box) const
+        {
+            return min_x <= box.max_x && box.min_x <= max_x && min_y <= box.max_y && box.min_y <= max_y;
+        }
+
+        bool Contains(const Aabb<T>& box) const
+        {
+            return min_x <= box.min_x && min_y <= box.min_y && box.max_x <= max_x && box.max_y <= max_y;
+        }
+
+        Aabb<T> Union(const Aabb<T>& box) const
+        {
+            Aabb<T> result = {std::min(min_x, box.min_x), std::min(min_y, box.min_y),
+                std::max(max_x, box.max_x), std::max(max_y, box.max_y)};
+            return result;
+        }
+
+        Aabb<T> Expanded(T margin) const
+        {
+            Aabb<T> result = {min_x - margin, min_y - margin, max_x + margin, max_y + margin};
+            return result;
+        }
+
+        T Perimeter() const
+        {
+            return 2 * ((max_x - min_x) + (max_y - min_y));
+        }
+    };
+
+
+    // Dynamic bounding volume hierarchy. Leaves store a fattened box, so objects that move a little keep
+    // their place in the tree; Move only reinserts a leaf once its tight box leaves the fat one.
+    // Insertion picks the sibling with the least perimeter growth, as in Box2D's b2DynamicTree.
+    template <class T>
+    class AabbTree
+    {
+        static_assert(std::is_floating_point<T>::value,
+              "AabbTree can be of floating point data types only");
+
+        struct Node
+        {
+            Aabb<T> box;
+            int parent;
+            int child1;
+            int child2;
+            int data;
+
+            bool IsLeaf() const
+            {
+                return child1 < 0;
+            }
+        };
+
+        std::vector<Node> _nodes;
+        int _root;
+        int _free_list;
+        // traversal scratch, kept so queries do not allocate
+        mutable std::vector<int> _stack;
+
+        int AllocateNode()
+        {
+            if (_free_list < 0)
+            {
+                Node node = {Aabb<T>(), -1, -1, -1, -1};
+                _nodes.push_back(node);
+                return (int) _nodes.size() - 1;
+            }
+            int index = _free_list;
+            _free_list = _nodes[index].parent;
+            _nodes[index].parent = -1;
+            _nodes[index].child1 = -1;
+            _nodes[index].child2 = -1;
+            _nodes[index].data = -1;
+            return index;
+        }
+
+        void FreeNode(int index)
+        {
+            _nodes[index].parent = _free_list;
+            _nodes[index].child1 = -1;
+            _free_list = index;
+        }
+
+        // recomputes the boxes of index and all its ancestors
+        void Refit(int index)
+        {
+            while (index >= 0)
+            {
+                Node& node = _nodes[index];
+                node.box = _nodes[node.child1].box.Union(_nodes[node.child2].box);
+                index = node.parent;
+            }
+        }
+
+        void InsertLeaf(int leaf)
+        {
+            if (_root < 0)
+            {
+                _root = leaf;
+                _nodes[leaf].parent = -1;
+                return;
+            }
+
+            // descend towards the cheapest sibling
+            const Aabb<T> box = _nodes[leaf].box;
+            int index = _root;
+            while (!_nodes[index].IsLeaf())
+            {
+                const Node& node = _nodes[index];
+                T area = node.box.Perimeter();
+                T combined_area = node.box.Union(box).Perimeter();
+
+                // cost of pairing with this node, and the growth every level below pays anyway
+                T cost = 2 * combined_area;
+                T inheritance_cost = 2 * (combined_area - area);
+
+                T child_cost[2];
+                int children[2] = {node.child1, node.child2};
+                for (int c = 0; c < 2; ++c)
+                {
+                    const Node& child = _nodes[children[c]];
+                    T grown = child.box.Union(box).Perimeter();
+                    child_cost[c] = (child.IsLeaf() ? grown : grown - child.box.Perimeter()) + inheritance_cost;
+                }
+
+                if (cost < child_cost[0] && cost < child_cost[1])
+                {
+                    break;
+                }
+                index = (child_cost[0] < child_cost[1]) ? children[0] : children[1];
+            }
+
+            int sibling = index;
+            int old_parent = _nodes[sibling].parent;
+            int new_parent = AllocateNode();
+            _nodes[new_parent].parent = old_parent;
+            _nodes[new_parent].child1 = sibling;
+            _nodes[new_parent].child2 = leaf;
+            _nodes[sibling].parent = new_parent;
+            _nodes[leaf].parent = new_parent;
+
+            if (old_parent < 0)
+            {
+                _root = new_parent;
+            }
+            else if (_nodes[old_parent].child1 == sibling)
+            {
+                _nodes[old_parent].child1 = new_parent;
+            }
+            else
+            {
+                _nodes[old_parent].child2 = new_parent;
+            }
+            Refit(new_parent);
+        }
+
+        void RemoveLeaf(int leaf)
+        {
+            if (leaf == _root)
+            {
+                _root = -1;
+                return;
+            }
+
+            int parent = _nodes[leaf].parent;
+            int grand_parent = _nodes[parent].parent;
+            int sibling = (_nodes[parent].child1 == leaf) ? _nodes[parent].child2 : _nodes[parent].child1;
+
+            if (grand_parent < 0)
+            {
+                _root = sibling;
+                _nodes[sibling].parent = -1;
+            }
+            else
+            {
+                if (_nodes[grand_parent].child1 == parent)
+                {
+                    _nodes[grand_parent].child1 = sibling;
+                }
+                else
+                {
+                    _nodes[grand_parent].child2 = sibling;
+                }
+                _nodes[sibling].parent = grand_parent;
+                Refit(grand_parent);
+            }
+            FreeNode(parent);
+        }
+
+    public:
+        AabbTree() : _root(-1), _free_list(-1)
+        {
+        }
+
+        void Clear()
+        {
+            _nodes.clear();
+            _root = -1;
+            _free_list = -1;
+        }
+
+        // Returns the leaf id, box should already be fattened
+        int Insert(const Aabb<T>& box, int data)
+        {
+            int leaf = AllocateNode();
+            _nodes[leaf].box = box;
+            _nodes[leaf].data = data;
+            InsertLeaf(leaf);
+            return leaf;
+        }
+
+        void Remove(int leaf)
+        {
+            RemoveLeaf(leaf);
+            FreeNode(leaf);
+        }
+
+        // Refits the leaf for a new tight box. Returns true if the leaf had to be reinserted.
+        bool Move(int leaf, const Aabb<T>& tight_box, T margin)
+        {
+            if (_nodes[leaf].box.Contains(tight_box))
+            {
+                return false;
+            }
+            RemoveLeaf(leaf);
+            _nodes[leaf].box = tight_box.Expanded(margin);
+            InsertLeaf(leaf);
+            return true;
+        }
+
+        const Aabb<T>& FatBox(int leaf) const
+        {
+            return _nodes[leaf].box;
+        }
+
+        // Calls visit(data) for every leaf whose fat box overlaps box
+        template <class F>
+        void Query(const Aabb<T>& box, const F& visit) const
+        {
+            if (_root < 0)
+            {
+                return;
+            }
+            _stack.clear();
+            _stack.push_back(_root);
+            while (!_stack.empty())
+            {
+                const Node& node = _nodes[_stack.back()];
+                _stack.pop_back();
+                if (!node.box.Overlaps(box))
+                {
+                    continue;
+                }
+                if (node.IsLeaf())
+                {
+                    visit(node.data);
+                    continue;
+                }
+                _stack.push_back(node.child1);
+                _stack.push_back(node.child2);
+            }
+        }
+    };
+}
+
+
+#endif /* defined(____bvh__) */
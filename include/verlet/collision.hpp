@@ -0,0 +1,539 @@
+
+#ifndef ____collision__
+#define ____collision__
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "math/vector2d.hpp"
+#include "verlet/particle.hpp"
+#include "verlet/constraints.hpp"
+#include "verlet/bvh.hpp"
+
+
+namespace verlet
+{
+    // Uniform grid over the plane, hashed into a table of buckets. Build counting-sorts the particles
+    // by bucket into one flat index array, so building and querying are both O(n).
+    template <class T>
+    class SpatialGrid
+    {
+        static_assert(std::is_floating_point<T>::value,
+              "SpatialGrid can be of floating point data types only");
+
+        T _cell_size;
+        T _inverse_cell_size;
+        uint32_t _mask;
+        std::vector<int> _bucket_start;
+        std::vector<int> _sorted;
+        std::vector<uint32_t> _particle_bucket;
+
+    public:
+        const std::vector<int>& bucket_start;
+        const std::vector<int>& sorted;
+
+        SpatialGrid() : _cell_size(1), _inverse_cell_size(1), _mask(0), bucket_start(_bucket_start),
+            sorted(_sorted)
+        {
+        }
+
+        T cell_size() const
+        {
+            return _cell_size;
+        }
+
+        int Cell(T coordinate) const
+        {
+            // floor without the libm call
+            T scaled = coordinate * _inverse_cell_size;
+            int cell = (int) scaled;
+            return cell - (scaled < cell);
+        }
+
+        uint32_t Bucket(int cell_x, int cell_y) const
+        {
+            return (((uint32_t) cell_x * 73856093u) ^ ((uint32_t) cell_y * 19349663u)) & _mask;
+        }
+
+        void Build(const ParticleArrays<T>& particles, int particle_count, T cell_size)
+        {
+            _cell_size = cell_size;
+            _inverse_cell_size = 1 / cell_size;
+
+            uint32_t bucket_count = 64;
+            while (bucket_count < (uint32_t) particle_count * 2)
+            {
+                bucket_count <<= 1;
+            }
+            _mask = bucket_count - 1;
+
+            _bucket_start.assign(bucket_count + 1, 0);
+            _particle_bucket.resize(particle_count);
+            _sorted.resize(particle_count);
+
+            for (int p = 0; p < particle_count; ++p)
+            {
+                uint32_t bucket = Bucket(Cell(particles.x[p]), Cell(particles.y[p]));
+                _particle_bucket[p] = bucket;
+                ++_bucket_start[bucket + 1];
+            }
+            for (uint32_t b = 0; b < bucket_count; ++b)
+            {
+                _bucket_start[b + 1] += _bucket_start[b];
+            }
+
+            // scatter, then shift the starts back since the scatter advanced them by one bucket
+            for (int p = 0; p < particle_count; ++p)
+            {
+                _sorted[_bucket_start[_particle_bucket[p]]++] = p;
+            }
+            for (uint32_t b = bucket_count; b > 0; --b)
+            {
+                _bucket_start[b] = _bucket_start[b - 1];
+            }
+            _bucket_start[0] = 0;
+        }
+
+        // Calls visit(bucket) once for each distinct bucket of the 3x3 cells around (x, y)
+        template <class F>
+        void ForEachNeighborBucket(T x, T y, const F& visit) const
+        {
+            int cell_x = Cell(x);
+            int cell_y = Cell(y);
+            uint32_t visited[9];
+            int visited_count = 0;
+            for (int dy = -1; dy <= 1; ++dy)
+            {
+                for (int dx = -1; dx <= 1; ++dx)
+                {
+                    uint32_t bucket = Bucket(cell_x + dx, cell_y + dy);
+                    bool seen = false;
+                    for (int v = 0; v < visited_count; ++v)
+                    {
+                        seen = seen || (visited[v] == bucket);
+                    }
+                    if (!seen)
+                    {
+                        visited[visited_count++] = bucket;
+                        visit(bucket);
+                    }
+                }
+            }
+        }
+
+        // Particle of the last Build closest to (x, y) and no further than max_distance from it, -1 if there
+        // is none. Only the 3x3 cells around the point are searched, so max_distance must not exceed the
+        // cell size.
+        int FindNearest(const ParticleArrays<T>& particles, T x, T y, T max_distance) const
+        {
+            int nearest = -1;
+            if (_bucket_start.empty())
+            {
+                return nearest;
+            }
+            T nearest_distance_square = max_distance * max_distance;
+            ForEachNeighborBucket(x, y, [&](uint32_t bucket) {
+                for (int i = _bucket_start[bucket]; i < _bucket_start[bucket + 1]; ++i)
+                {
+                    int p = _sorted[i];
+                    T dx = particles.x[p] - x;
+                    T dy = particles.y[p] - y;
+                    T distance_square = (dx * dx) + (dy * dy);
+                    if (distance_square <= nearest_distance_square)
+                    {
+                        nearest = p;
+                        nearest_distance_square = distance_square;
+                    }
+                }
+            });
+            return nearest;
+        }
+    };
+
+
+    // Particle-particle contacts. Particles with a radius above 0 are pushed apart when they overlap, unless
+    // they belong to the same group (usually the same composite, whose constraints already hold it in shape).
+    //
+    // Prepare runs the grid broadphase once per step and keeps every pair that is within a margin of touching;
+    // Relax then only walks that pair list, so the relaxation iterations never touch the grid.
+    template <class T>
+    class ParticleCollisions
+    {
+        static_assert(std::is_floating_point<T>::value,
+              "ParticleCollisions can be of floating point data types only");
+
+        SpatialGrid<T> _grid;
+        T _max_radius;
+        std::vector<int> _pairs;
+
+    public:
+        const SpatialGrid<T>& grid;
+        // candidate pairs of this step, two particle indices each
+        const std::vector<int>& pairs;
+
+        ParticleCollisions() : _max_radius(0), grid(_grid), pairs(_pairs)
+        {
+        }
+
+        bool enabled() const
+        {
+            return _max_radius > 0;
+        }
+
+        int pair_count() const
+        {
+            return (int) _pairs.size() / 2;
+        }
+
+        // Rebuilds the grid and the candidate pairs from the current positions, once per step.
+        // groups[p] < 0 means the particle collides with everything.
+        void Prepare(const ParticleArrays<T>& particles, int particle_count, const int* groups)
+        {
+            _pairs.clear();
+            _max_radius = 0;
+            for (int p = 0; p < particle_count; ++p)
+            {
+                _max_radius = std::max(_max_radius, particles.radius[p]);
+            }
+            if (!enabled())
+            {
+                return;
+            }
+
+            // pairs closer than radius + radius + margin are kept, the cells are sized to find all of them
+            const T margin = _max_radius;
+            _grid.Build(particles, particle_count, 2 * _max_radius + margin);
+
+            const T* x = particles.x;
+            const T* y = particles.y;
+            const T* radius = particles.radius;
+            const std::vector<int>& bucket_start = _grid.bucket_start;
+            const std::vector<int>& sorted = _grid.sorted;
+            for (int p = 0; p < particle_count; ++p)
+            {
+                if (radius[p] <= 0)
+                {
+                    continue;
+                }
+                _grid.ForEachNeighborBucket(x[p], y[p], [&](uint32_t bucket) {
+                    for (int s = bucket_start[bucket]; s < bucket_start[bucket + 1]; ++s)
+                    {
+                        int q = sorted[s];
+                        // each pair once, and never within a group
+                        if (q <= p || radius[q] <= 0 || (groups[p] >= 0 && groups[p] == groups[q]))
+                        {
+                            continue;
+                        }
+
+                        T dx = x[q] - x[p];
+                        T dy = y[q] - y[p];
+                        T reach = radius[p] + radius[q] + margin;
+                        if ((dx * dx) + (dy * dy) < reach * reach)
+                        {
+                            _pairs.push_back(p);
+                            _pairs.push_back(q);
+                        }
+                    }
+                });
+            }
+        }
+
+        // One projection pass over the candidate pairs, meant to run inside the relaxation iterations.
+        // mobility[p] is 1 for particles that may move and 0 for ones that stay put (sleeping particles);
+        // the correction is shared between the movable side(s) of each pair.
+        void Relax(const ParticleArrays<T>& particles, const T* mobility)
+        {
+            T* x = particles.x;
+            T* y = particles.y;
+            const T* radius = particles.radius;
+
+            const int* pair = _pairs.data();
+            const int* end = pair + _pairs.size();
+            for (; pair != end; pair += 2)
+            {
+                int p = pair[0];
+                int q = pair[1];
+                T dx = x[q] - x[p];
+                T dy = y[q] - y[p];
+                T distance_square = (dx * dx) + (dy * dy);
+                T min_distance = radius[p] + radius[q];
+                T mobility_sum = mobility[p] + mobility[q];
+                if (distance_square >= min_distance * min_distance || distance_square <= 0 || mobility_sum <= 0)
+                {
+                    continue;
+                }
+
+                T distance = std::sqrt(distance_square);
+                T push = ((min_distance - distance) / distance) / mobility_sum;
+                T push_p = push * mobility[p];
+                T push_q = push * mobility[q];
+                x[p] -= dx * push_p;
+                y[p] -= dy * push_p;
+                x[q] += dx * push_q;
+                y[q] += dy * push_q;
+            }
+        }
+    };
+
+
+    // Contacts between the particles of one composite and the edges (distance constraints) of another, so
+    // a tire rolls on a cloth instead of dropping through the gaps between its particles.
+    //
+    // Every composite keeps a leaf in an AabbTree; Prepare refits the leaves, and for each pair of composites
+    // whose fat boxes overlap collects the particle/edge pairs within a margin of touching. Relax then pushes
+    // each particle out of its edges, sharing the correction with the edge endpoints.
+    template <class T>
+    class EdgeCollisions
+    {
+        static_assert(std::is_floating_point<T>::value,
+              "EdgeCollisions can be of floating point data types only");
+
+        AabbTree<T> _tree;
+        std::vector<int> _proxies;
+        std::vector<Aabb<T> > _boxes;
+        std::vector<T> _max_radius;
+
+        // particles and edges of each composite, grouped with counting sorts
+        std::vector<int> _particle_start;
+        std::vector<int> _particles;
+        std::vector<int> _edge_start;
+        std::vector<int> _edges;
+
+        std::vector<int> _contacts;
+
+        void NarrowPhase(const ParticleArrays<T>& particles, int composite, int other)
+        {
+            const T* x = particles.x;
+            const T* y = particles.y;
+            const T* radius = particles.radius;
+            const Aabb<T>& other_box = _boxes[other];
+            const int* edge_begin = _edges.data() + 2 * _edge_start[other];
+            const int* edge_end = _edges.data() + 2 * _edge_start[other + 1];
+
+            for (int i = _particle_start[composite]; i < _particle_start[composite + 1]; ++i)
+            {
+                int p = _particles[i];
+                if (radius[p] <= 0)
+                {
+                    continue;
+                }
+
+                // the margin equals the radius, so contacts are kept up to two radii away
+                const T reach = 2 * radius[p];
+                const Aabb<T> particle_box = {x[p] - reach, y[p] - reach, x[p] + reach, y[p] + reach};
+                if (!particle_box.Overlaps(other_box))
+                {
+                    continue;
+                }
+
+                for (const int* edge = edge_begin; edge != edge_end; edge += 2)
+                {
+                    int a = edge[0];
+                    int b = edge[1];
+                    const Aabb<T> edge_box = {std::min(x[a], x[b]), std::min(y[a], y[b]),
+                        std::max(x[a], x[b]), std::max(y[a], y[b])};
+                    if (particle_box.Overlaps(edge_box))
+                    {
+                        _contacts.push_back(p);
+                        _contacts.push_back(a);
+                        _contacts.push_back(b);
+                    }
+                }
+            }
+        }
+
+    public:
+        // candidate contacts of this step, as (particle, edge particle 1, edge particle 2) triples
+        const std::vector<int>& contacts;
+
+        EdgeCollisions() : contacts(_contacts)
+        {
+        }
+
+        bool enabled() const
+        {
+            return !_edges.empty();
+        }
+
+        int contact_count() const
+        {
+            return (int) _contacts.size() / 3;
+        }
+
+        // Regroups the particles and edges by composite, after the pool topology changed.
+        // groups[p] is the composite of particle p, or -1. Edges joining two composites are ignored.
+        void Build(const int* groups, int particle_count, int composite_count,
+            const DistanceConstraint<T>* constraints, int constraint_count)
+        {
+            _particle_start.assign(composite_count + 1, 0);
+            _edge_start.assign(composite_count + 1, 0);
+            for (int p = 0; p < particle_count; ++p)
+            {
+                if (groups[p] >= 0)
+                {
+                    ++_particle_start[groups[p] + 1];
+                }
+            }
+            for (int c = 0; c < constraint_count; ++c)
+            {
+                int group = groups[constraints[c].particle1];
+                if (group >= 0 && group == groups[constraints[c].particle2])
+                {
+                    ++_edge_start[group + 1];
+                }
+            }
+            for (int c = 0; c < composite_count; ++c)
+            {
+                _particle_start[c + 1] += _particle_start[c];
+                _edge_start[c + 1] += _edge_start[c];
+            }
+
+            std::vector<int> particle_fill(_particle_start.begin(), _particle_start.end() - 1);
+            std::vector<int> edge_fill(_edge_start.begin(), _edge_start.end() - 1);
+            _particles.resize(_particle_start[composite_count]);
+            _edges.resize(2 * _edge_start[composite_count]);
+            for (int p = 0; p < particle_count; ++p)
+            {
+                if (groups[p] >= 0)
+                {
+                    _particles[particle_fill[groups[p]]++] = p;
+                }
+            }
+            for (int c = 0; c < constraint_count; ++c)
+            {
+                int group = groups[constraints[c].particle1];
+                if (group >= 0 && group == groups[constraints[c].particle2])
+                {
+                    int slot = edge_fill[group]++;
+                    _edges[2 * slot] = constraints[c].particle1;
+                    _edges[2 * slot + 1] = constraints[c].particle2;
+                }
+            }
+
+            _tree.Clear();
+            _proxies.assign(composite_count, -1);
+            _boxes.resize(composite_count);
+            _max_radius.assign(composite_count, 0);
+        }
+
+        // Refits the tree and collects the candidate contacts from the current positions, once per step
+        void Prepare(const ParticleArrays<T>& particles)
+        {
+            _contacts.clear();
+            if (!enabled())
+            {
+                return;
+            }
+
+            const T* x = particles.x;
+            const T* y = particles.y;
+            const T* radius = particles.radius;
+            int composite_count = (int) _proxies.size();
+            for (int c = 0; c < composite_count; ++c)
+            {
+                int begin = _particle_start[c];
+                int end = _particle_start[c + 1];
+                if (begin == end)
+                {
+                    continue;
+                }
+
+                Aabb<T> box = {x[_particles[begin]], y[_particles[begin]], x[_particles[begin]], y[_particles[begin]]};
+                T max_radius = 0;
+                for (int i = begin; i < end; ++i)
+                {
+                    int p = _particles[i];
+                    box.min_x = std::min(box.min_x, x[p]);
+                    box.min_y = std::min(box.min_y, y[p]);
+                    box.max_x = std::max(box.max_x, x[p]);
+                    box.max_y = std::max(box.max_y, y[p]);
+                    max_radius = std::max(max_radius, radius[p]);
+                }
+                _boxes[c] = box.Expanded(max_radius);
+                _max_radius[c] = max_radius;
+
+                // fatten by a few radii so slow composites keep their leaf for many steps
+                T margin = 4 * max_radius + 1;
+                if (_proxies[c] < 0)
+                {
+                    _proxies[c] = _tree.Insert(_boxes[c].Expanded(margin), c);
+                }
+                else
+                {
+                    _tree.Move(_proxies[c], _boxes[c], margin);
+                }
+            }
+
+            for (int c = 0; c < composite_count; ++c)
+            {
+                // composites without radius have nothing to push against the other composite's edges
+                if (_proxies[c] < 0 || _max_radius[c] <= 0)
+                {
+                    continue;
+                }
+                _tree.Query(_tree.FatBox(_proxies[c]), [&](int other) {
+                    if (other != c && _edge_start[other] != _edge_start[other + 1])
+                    {
+                        NarrowPhase(particles, c, other);
+                    }
+                });
+            }
+        }
+
+        // One projection pass over the candidate contacts, meant to run inside the relaxation iterations.
+        // mobility is as for ParticleCollisions::Relax; both ends of an edge share a composite, so the edge
+        // uses the mobility of its first end.
+        void Relax(const ParticleArrays<T>& particles, const T* mobility)
+        {
+            T* x = particles.x;
+            T* y = particles.y;
+            const T* radius = particles.radius;
+
+            const int* contact = _contacts.data();
+            const int* end = contact + _contacts.size();
+            for (; contact != end; contact += 3)
+            {
+                int p = contact[0];
+                int a = contact[1];
+                int b = contact[2];
+
+                // closest point on the edge
+                T edge_x = x[b] - x[a];
+                T edge_y = y[b] - y[a];
+                T edge_length_square = (edge_x * edge_x) + (edge_y * edge_y);
+                T t = 0;
+                if (edge_length_square > 0)
+                {
+                    t = (((x[p] - x[a]) * edge_x) + ((y[p] - y[a]) * edge_y)) / edge_length_square;
+                    t = std::min(std::max(t, T(0)), T(1));
+                }
+                T dx = x[p] - (x[a] + (edge_x * t));
+                T dy = y[p] - (y[a] + (edge_y * t));
+                T distance_square = (dx * dx) + (dy * dy);
+                T mobility_sum = mobility[p] + mobility[a];
+                if (distance_square >= radius[p] * radius[p] || distance_square <= 0 || mobility_sum <= 0)
+                {
+                    continue;
+                }
+
+                // the correction is shared between the particle and the edge, split between the edge's ends
+                T distance = std::sqrt(distance_square);
+                T push = ((radius[p] - distance) / distance) / mobility_sum;
+                T push_p = push * mobility[p];
+                T push_edge = push * mobility[a];
+                x[p] += dx * push_p;
+                y[p] += dy * push_p;
+                x[a] -= dx * push_edge * (1 - t);
+                y[a] -= dy * push_edge * (1 - t);
+                x[b] -= dx * push_edge * t;
+                y[b] -= dy * push_edge * t;
+            }
+        }
+    };
+}
+
+
+#endif /* defined(____collision__) */
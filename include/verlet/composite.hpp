@@ -3,6 +3,7 @@
 #define ____composite__
 
 
+#include <type_traits>
 #include <vector>
 
 #include "verlet/particle.hpp"
@@ -11,48 +12,236 @@
 
 namespace verlet
 {
+    // Run of consecutive indices [first, first + count) into one array of the object pool. Iterates like a
+    // container of those indices.
+    struct IndexRange
+    {
+        int first;
+        int count;
+
+        class iterator
+        {
+            int _index;
+
+        public:
+            explicit iterator(int index) : _index(index)
+            {
+            }
+
+            int operator*() const
+            {
+                return _index;
+            }
+
+            iterator& operator++()
+            {
+                ++_index;
+                return *this;
+            }
+
+            bool operator==(const iterator& other) const
+            {
+                return _index == other._index;
+            }
+
+            bool operator!=(const iterator& other) const
+            {
+                return _index != other._index;
+            }
+        };
+
+        IndexRange() : first(0), count(0)
+        {
+        }
+
+        IndexRange(int first, int count) : first(first), count(count)
+        {
+        }
+
+        iterator begin() const
+        {
+            return iterator(first);
+        }
+
+        iterator end() const
+        {
+            return iterator(first + count);
+        }
+
+        int size() const
+        {
+            return count;
+        }
+
+        bool empty() const
+        {
+            return count == 0;
+        }
+
+        int operator[](int i) const
+        {
+            return first + i;
+        }
+
+        bool Contains(int index) const
+        {
+            return index >= first && index < first + count;
+        }
+    };
+
+
+    // The particles and constraints of one object. The builders allocate them contiguously from the object
+    // pool, so a composite only holds one index range per array, needs no memory of its own and is copied
+    // as plain bytes.
     template <class T>
     class Composite
     {
         static_assert(std::is_floating_point<T>::value,
               "Composite can be of floating point data types only");
 
-        std::vector<Particle<T>*> _particles;
-        std::vector<Constraint<T>*> _constraints;
+        // one range per constraint kind id
+        IndexRange _particles;
+        IndexRange _constraints[MAX_CONSTRAINT_KINDS];
+
+        // Grows range by index if it is the next one; anything else would not be a range
+        static bool Extend(IndexRange& range, int index)
+        {
+            if (range.empty())
+            {
+                range = IndexRange(index, 1);
+                return true;
+            }
+            if (index != range.first + range.count)
+            {
+                return false;
+            }
+            ++range.count;
+            return true;
+        }
+
+        // Applies an old to new index map that keeps order, dropping the entries that map to -1
+        static void Remap(IndexRange& range, const std::vector<int>& remap)
+        {
+            IndexRange kept;
+            for (int index = range.first; index < range.first + range.count; ++index)
+            {
+                if (remap[index] >= 0)
+                {
+                    if (kept.empty())
+                    {
+                        kept.first = remap[index];
+                    }
+                    ++kept.count;
+                }
+            }
+            range = kept;
+        }
+
     public:
-        const std::vector<Particle<T>*>& particles;
-        const std::vector<Constraint<T>*>& constraints;
+        const IndexRange& particles() const
+        {
+            return _particles;
+        }
+
+        // kind is the id of the constraint kind in the object pool, see ObjectPool::KindId
+        const IndexRange& constraints(int kind) const
+        {
+            return _constraints[kind];
+        }
+
+        const IndexRange& pin_constraints() const
+        {
+            return _constraints[PIN_CONSTRAINT];
+        }
+
+        const IndexRange& distance_constraints() const
+        {
+            return _constraints[DISTANCE_CONSTRAINT];
+        }
+
+        const IndexRange& angular_constraints() const
+        {
+            return _constraints[ANGULAR_CONSTRAINT];
+        }
 
-        const int particle_count()
+        int particle_count() const
         {
-            return _particles.size();
+            return _particles.count;
         }
 
-        const int constraint_count()
+        int constraint_count() const
         {
-            return _constraints.size();
+            int count = 0;
+            for (int kind = 0; kind < MAX_CONSTRAINT_KINDS; ++kind)
+            {
+                count += _constraints[kind].count;
+            }
+            return count;
         }
 
-        Composite() : particles(_particles), constraints(_constraints)
+        void SetParticles(const IndexRange& particles)
         {
+            _particles = particles;
         }
 
-        void AddParticle(Particle<T>* particle)
+        void SetConstraints(int kind, const IndexRange& constraints)
         {
-            _particles.push_back(particle);
+            _constraints[kind] = constraints;
         }
 
-        void AddConstraint(Constraint<T>* constraint)
+        // The Add methods append one index, which has to follow the last one added. Return false, leaving
+        // the composite as it was, otherwise.
+        bool AddParticle(int particle)
         {
-            _constraints.push_back(constraint);
+            return Extend(_particles, particle);
         }
 
-        void operator=(const Composite<T>& composite)
+        bool AddConstraint(int kind, int constraint)
         {
-            _particles = composite.particles;
-            _constraints = composite._constraints;
+            return Extend(_constraints[kind], constraint);
+        }
+
+        bool AddPinConstraint(int constraint)
+        {
+            return AddConstraint(PIN_CONSTRAINT, constraint);
+        }
+
+        bool AddDistanceConstraint(int constraint)
+        {
+            return AddConstraint(DISTANCE_CONSTRAINT, constraint);
+        }
+
+        bool AddAngularConstraint(int constraint)
+        {
+            return AddConstraint(ANGULAR_CONSTRAINT, constraint);
+        }
+
+        // Called by the object pool after it compacted its arrays, with one constraint remap per kind. The
+        // pool keeps the order of what it keeps, so every range stays a range.
+        void Reindex(const std::vector<int>& particle_remap, const std::vector<int>* constraint_remaps,
+            int kind_count)
+        {
+            Remap(_particles, particle_remap);
+            for (int kind = 0; kind < kind_count; ++kind)
+            {
+                Remap(_constraints[kind], constraint_remaps[kind]);
+            }
         }
     };
+
+    static_assert(std::is_trivially_copyable<Composite<float> >::value,
+        "Composite should be a plain value");
+
+    // Gives every particle of the composite the same collision radius, 0 turns collisions off
+    template <class T>
+    void SetCollisionRadius(const Composite<T>& composite, const ParticleArrays<T>& particles, T radius)
+    {
+        const IndexRange& range = composite.particles();
+        for (int particle = range.first; particle < range.first + range.count; ++particle)
+        {
+            particles.radius[particle] = radius;
+        }
+    }
 }
 
 
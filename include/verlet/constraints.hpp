@@ -3,178 +3,259 @@
 #define ____constraints__
 
 #include <cmath>
+#include <type_traits>
+#include <vector>
 
 #include "math/vector2d.hpp"
 #include "verlet/particle.hpp"
 
 namespace verlet
 {
-    template<class T>
-    class Constraint
-    {
-        static_assert(std::is_floating_point<T>::value,
-                      "Constraint can be of floating point data types only");
-
-    public:
-        virtual void Relax(T stepCoeff) = 0;
-    };
+    // Constraints are plain values, stored by kind in their own packed array of the object pool and relaxed
+    // by a loop over that array, so nothing here is virtual. A constraint kind provides:
+    //
+    //     void Relax(const ParticleArrays<T>& particles, T stepCoeff);
+    //     template <class F> void ForEachParticle(const F& visit) const;   // visit(int particle)
+    //     void Reindex(const std::vector<int>& particle_remap);            // after the pool compacts
+    //
+    // New kinds are registered as extra template arguments of ObjectPool and Verlet.
 
     template<class T>
-    class PinConstraint: public Constraint<T>
+    struct PinConstraint
     {
         static_assert(std::is_floating_point<T>::value,
               "PinConstraint can be of floating point data types only");
 
-        Particle<T>* _particle;
-        math::Vector2d<T> _position;
-    public:
-        Particle<T>* const & particle;
-        const math::Vector2d<T>& position;
+        int particle;
+        math::Vector2d<T> position;
 
-        PinConstraint() : particle(_particle), position(_position)
+        PinConstraint() : particle(-1), position(0, 0)
         {
-            _particle = nullptr;
-            _position = math::Vector2d<T>(0, 0);
         }
-        
-        PinConstraint(Particle<T>* particle, math::Vector2d<T>& position) : particle(_particle), position(_position)
+
+        PinConstraint(int particle, const math::Vector2d<T>& position) : particle(particle), position(position)
         {
-            _particle = particle;
-            _position = position;
         }
 
-        void Relax(T stepCoeff)
+        void Relax(const ParticleArrays<T>& particles, T stepCoeff)
         {
-            _particle->position = _position;
+            particles.SetPosition(particle, position);
         }
 
-        void operator=(const PinConstraint<T>& constraint) {
-            _particle = constraint.particle;
-            _position = constraint.position;
+        template <class F>
+        void ForEachParticle(const F& visit) const
+        {
+            visit(particle);
+        }
+
+        // Follows the particle to its new index after the pool compacted its arrays
+        void Reindex(const std::vector<int>& particle_remap)
+        {
+            particle = particle_remap[particle];
         }
     };
 
 
     template<class T>
-    class DistanceConstraint: public Constraint<T>
+    struct DistanceConstraint
     {
         static_assert(std::is_floating_point<T>::value,
               "DistanceConstraint can be of floating point data types only");
 
-        Particle<T>* _particle1;
-        Particle<T>* _particle2;
-        T _stiffness;
-        T _distance;
-    public:
-        Particle<T>* const & particle1;
-        Particle<T>* const & particle2;
-        const T& stiffness;
-        const T& distance;
+        int particle1;
+        int particle2;
+        T stiffness;
+        T distance;
+        // inverse stiffness for the XPBD solver mode, which ignores stiffness; 0 is rigid
+        T compliance;
 
-        DistanceConstraint() : particle1(_particle1), particle2(_particle2), stiffness(_stiffness), distance(_distance)
+        DistanceConstraint() : particle1(-1), particle2(-1), stiffness(1), distance(0), compliance(0)
         {
-            _particle1 = nullptr;
-            _particle2 = nullptr;
-            _stiffness = 1;
-            _distance = 0;
         }
 
-        DistanceConstraint(Particle<T>* particle1, Particle<T>* particle2, T stiffness)
-        : particle1(_particle1), particle2(_particle2), stiffness(_stiffness), distance(_distance)
+        DistanceConstraint(const ParticleArrays<T>& particles, int particle1, int particle2, T stiffness,
+            T compliance = 0)
+            : particle1(particle1), particle2(particle2), stiffness(stiffness), compliance(compliance)
         {
-            _particle1 = particle1;
-            _particle2 = particle2;
-            _stiffness = stiffness;
-            _distance = math::EuclideanLength<T>(particle1->position - particle2->position);
+            distance = math::EuclideanLength<T>(particles.Position(particle1) - particles.Position(particle2));
         }
 
-        void Relax(T stepCoeff)
+        void Relax(const ParticleArrays<T>& particles, T stepCoeff)
         {
-            math::Vector2d<T> normal = particle1->position - particle2->position;
+            math::Vector2d<T> normal = particles.Position(particle1) - particles.Position(particle2);
             T normal_length_square = math::EuclideanLengthSquare(normal);
             normal *= (((distance*distance - normal_length_square)/normal_length_square) * stiffness * stepCoeff);
-            particle1->position += normal;
-            particle2->position -= normal;
+            particles.Translate(particle1, normal);
+            particles.Translate(particle2, -normal);
+        }
+
+        template <class F>
+        void ForEachParticle(const F& visit) const
+        {
+            visit(particle1);
+            visit(particle2);
         }
-        
-        void operator=(const DistanceConstraint<T>& constraint) {
-            _particle1 = constraint.particle1;
-            _particle2 = constraint.particle2;
-            _stiffness = constraint.stiffness;
-            _distance = constraint.distance;
+
+        void Reindex(const std::vector<int>& particle_remap)
+        {
+            particle1 = particle_remap[particle1];
+            particle2 = particle_remap[particle2];
         }
     };
 
 
+    // One relaxation of the angle at vertex between particle1 and particle2 towards the rest angle given by
+    // its cosine and sine, on raw coordinates so the batched kernels can share it. The current angle is only
+    // ever known through the dot and cross products of the arms, so there is no atan2, sin or cos: the
+    // error is the rotation current * conjugate(rest), and the applied rotation is the normalized lerp from
+    // no rotation to the error by coeff, which is close to coeff times the error angle and never overshoots.
     template<class T>
-    class AngularConstraint: public Constraint<T>
+    inline void RelaxAngle(T* x, T* y, int particle1, int vertex, int particle2, T rest_cos, T rest_sin, T coeff)
     {
-        static_assert(std::is_floating_point<T>::value,
-              "AngularConstraint can be of floating point data types only");
+        T vertex_x = x[vertex];
+        T vertex_y = y[vertex];
+        T a_x = x[particle1] - vertex_x;
+        T a_y = y[particle1] - vertex_y;
+        T b_x = x[particle2] - vertex_x;
+        T b_y = y[particle2] - vertex_y;
 
-        Particle<T>* _particle1;
-        Particle<T>* _vertex;
-        Particle<T>* _particle2;
-        T _stiffness;
-        T _angle;
+        T dot = (a_x * b_x) + (a_y * b_y);
+        T cross = (a_x * b_y) - (a_y * b_x);
+        T length = std::sqrt(((a_x * a_x) + (a_y * a_y)) * ((b_x * b_x) + (b_y * b_y)));
 
-    public:
-        Particle<T>* const & particle1;
-        Particle<T>* const & vertex;
-        Particle<T>* const & particle2;
-        const T& stiffness;
-        const T& angle_in_radians;
+        // error rotation scaled by length, blended with the identity rotation scaled the same way
+        T rotation_x = ((1 - coeff) * length) + (coeff * ((dot * rest_cos) + (cross * rest_sin)));
+        T rotation_y = coeff * ((cross * rest_cos) - (dot * rest_sin));
+        T rotation_length_square = (rotation_x * rotation_x) + (rotation_y * rotation_y);
 
-        AngularConstraint() : particle1(_particle1), vertex(_vertex), particle2(_particle2),
-            stiffness(_stiffness), angle_in_radians(_angle)
+        // collapsed arms or an error of exactly half a turn have no direction to rotate in
+        T cosine = 1;
+        T sine = 0;
+        if (rotation_length_square > 0)
         {
-            _particle1 = nullptr;
-            _particle2 = nullptr;
-            _vertex = nullptr;
-            _stiffness = 1;
-            _angle = 0;
+            T inverse_length = 1 / std::sqrt(rotation_length_square);
+            cosine = rotation_x * inverse_length;
+            sine = rotation_y * inverse_length;
         }
 
-        AngularConstraint(Particle<T>* particle1, Particle<T>* vertex, Particle<T>* particle2, T stiffness)
-        : particle1(_particle1), vertex(_vertex), particle2(_particle2), stiffness(_stiffness),
-            angle_in_radians(_angle)
+        // particle1 turns by the rotation and particle2 by its inverse around the vertex, then the vertex
+        // turns the same way around each of them
+        T position1_x = ((a_x * cosine) - (a_y * sine)) + vertex_x;
+        T position1_y = ((a_x * sine) + (a_y * cosine)) + vertex_y;
+        T position2_x = ((b_x * cosine) + (b_y * sine)) + vertex_x;
+        T position2_y = ((b_y * cosine) - (b_x * sine)) + vertex_y;
+
+        T d_x = vertex_x - position1_x;
+        T d_y = vertex_y - position1_y;
+        vertex_x = ((d_x * cosine) - (d_y * sine)) + position1_x;
+        vertex_y = ((d_x * sine) + (d_y * cosine)) + position1_y;
+        d_x = vertex_x - position2_x;
+        d_y = vertex_y - position2_y;
+        vertex_x = ((d_x * cosine) + (d_y * sine)) + position2_x;
+        vertex_y = ((d_y * cosine) - (d_x * sine)) + position2_y;
+
+        x[particle1] = position1_x;
+        y[particle1] = position1_y;
+        x[particle2] = position2_x;
+        y[particle2] = position2_y;
+        x[vertex] = vertex_x;
+        y[vertex] = vertex_y;
+    }
+
+
+    template<class T>
+    struct AngularConstraint
+    {
+        static_assert(std::is_floating_point<T>::value,
+              "AngularConstraint can be of floating point data types only");
+
+        int particle1;
+        int vertex;
+        int particle2;
+        T stiffness;
+        // rest angle from the particle1 arm to the particle2 arm, as a unit rotation
+        T rest_cos;
+        T rest_sin;
+        // inverse stiffness of the angle for the XPBD solver mode, which ignores stiffness; 0 is rigid
+        T compliance;
+
+        AngularConstraint() : particle1(-1), vertex(-1), particle2(-1), stiffness(1), rest_cos(1), rest_sin(0),
+            compliance(0)
         {
-            _particle1 = particle1;
-            _particle2 = particle2;
-            _vertex = vertex;
-            _stiffness = stiffness;
-            _angle = math::Angle(vertex->position, particle1->position, particle2->position);
         }
 
-        void Relax(T stepCoeff)
+        AngularConstraint(const ParticleArrays<T>& particles, int particle1, int vertex, int particle2,
+            T stiffness, T compliance = 0)
+            : particle1(particle1), vertex(vertex), particle2(particle2), stiffness(stiffness), rest_cos(1),
+            rest_sin(0), compliance(compliance)
         {
-            T angle = math::Angle(vertex->position, particle1->position, particle2->position);
-            T diff = angle - angle_in_radians;
-
-            if (diff <= -M_PI)
-            {
-                diff += (2 * M_PI);
-            }
-            else if (diff >= M_PI)
+            math::Vector2d<T> vertex_position = particles.Position(vertex);
+            math::Vector2d<T> start = particles.Position(particle1) - vertex_position;
+            math::Vector2d<T> end = particles.Position(particle2) - vertex_position;
+            T length = std::sqrt(math::EuclideanLengthSquare(start) * math::EuclideanLengthSquare(end));
+            if (length > 0)
             {
-                diff -= (2 * M_PI);
+                rest_cos = math::DotProduct(start, end) / length;
+                rest_sin = math::CrossProduct(start, end) / length;
             }
+        }
 
-            diff *= stepCoeff * stiffness;
-            particle1->position = math::Rotate(particle1->position, vertex->position, diff);
-            particle2->position = math::Rotate(particle2->position, vertex->position, -diff);
-            vertex->position = math::Rotate(vertex->position, particle1->position, diff);
-            vertex->position = math::Rotate(vertex->position, particle2->position, -diff);
+        T angle_in_radians() const
+        {
+            return std::atan2(rest_sin, rest_cos);
         }
-        
-        void operator=(const AngularConstraint<T>& constraint) {
-            _particle1 = constraint.particle1;
-            _vertex = constraint.vertex;
-            _particle2 = constraint.particle2;
-            _stiffness = constraint.stiffness;
-            _angle = constraint.angle_in_radians;
+
+        void Relax(const ParticleArrays<T>& particles, T stepCoeff)
+        {
+            RelaxAngle(particles.x, particles.y, particle1, vertex, particle2, rest_cos, rest_sin,
+                stepCoeff * stiffness);
+        }
+
+        template <class F>
+        void ForEachParticle(const F& visit) const
+        {
+            visit(particle1);
+            visit(vertex);
+            visit(particle2);
+        }
+
+        void Reindex(const std::vector<int>& particle_remap)
+        {
+            particle1 = particle_remap[particle1];
+            vertex = particle_remap[vertex];
+            particle2 = particle_remap[particle2];
         }
     };
+
+    static_assert(std::is_trivially_copyable<DistanceConstraint<float> >::value
+        && sizeof(DistanceConstraint<float>) == 2 * sizeof(int) + 3 * sizeof(float),
+        "DistanceConstraint should be a packed plain value");
+
+
+    // Position of Kind in a list of constraint kinds, which is its id in the object pool
+    template <class Kind, class... Kinds>
+    struct KindIndex;
+
+    template <class Kind, class... Rest>
+    struct KindIndex<Kind, Kind, Rest...>
+    {
+        static const int value = 0;
+    };
+
+    template <class Kind, class First, class... Rest>
+    struct KindIndex<Kind, First, Rest...>
+    {
+        static const int value = 1 + KindIndex<Kind, Rest...>::value;
+    };
+
+    // The built in kinds always come first, in this order
+    enum
+    {
+        PIN_CONSTRAINT = 0,
+        DISTANCE_CONSTRAINT = 1,
+        ANGULAR_CONSTRAINT = 2,
+        MAX_CONSTRAINT_KINDS = 8
+    };
 }
 
 
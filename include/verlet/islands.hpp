@@ -0,0 +1,304 @@
+
+#ifndef ____islands__
+#define ____islands__
+
+
+#include <algorithm>
+#include <vector>
+
+#include "verlet/particle.hpp"
+#include "verlet/constraints.hpp"
+
+
+namespace verlet
+{
+    // Groups the particles into islands, the connected components of the constraint graph, and puts
+    // islands that stopped moving to sleep.
+    //
+    // An island sleeps once its fastest particle stayed under the sleep velocity for SLEEP_STEPS steps in
+    // a row; its velocity is zeroed and the solver skips it until Wake is called on it. The awake particles
+    // are kept as a list of index ranges, so the per-particle phases still run over contiguous memory.
+    template <class T>
+    class Islands
+    {
+        static_assert(std::is_floating_point<T>::value,
+              "Islands can be of floating point data types only");
+
+        std::vector<int> _parent;
+        std::vector<int> _particle_island;
+        std::vector<int> _island_start;
+        std::vector<int> _particles;
+
+        std::vector<int> _still_steps;
+        std::vector<T> _motion;
+        std::vector<char> _asleep;
+        std::vector<int> _awake_ranges;
+        std::vector<T> _mobility;
+        int _sleeping_count;
+        int _version;
+        bool _dirty;
+        T _sleep_velocity;
+
+        static int Find(std::vector<int>& parent, int p)
+        {
+            while (parent[p] != p)
+            {
+                parent[p] = parent[parent[p]];
+                p = parent[p];
+            }
+            return p;
+        }
+
+        static void Union(std::vector<int>& parent, int p1, int p2)
+        {
+            int root1 = Find(parent, p1);
+            int root2 = Find(parent, p2);
+            if (root1 != root2)
+            {
+                // the lower index becomes the root, so island numbering follows the particle order
+                parent[std::max(root1, root2)] = std::min(root1, root2);
+            }
+        }
+
+        void RebuildRanges()
+        {
+            _awake_ranges.clear();
+            int particle_count = (int) _particle_island.size();
+            _mobility.resize(particle_count);
+            for (int p = 0; p < particle_count; ++p)
+            {
+                _mobility[p] = _asleep[_particle_island[p]] ? T(0) : T(1);
+            }
+
+            int p = 0;
+            while (p < particle_count)
+            {
+                if (_asleep[_particle_island[p]])
+                {
+                    ++p;
+                    continue;
+                }
+                int begin = p;
+                while (p < particle_count && !_asleep[_particle_island[p]])
+                {
+                    ++p;
+                }
+                _awake_ranges.push_back(begin);
+                _awake_ranges.push_back(p);
+            }
+            ++_version;
+            _dirty = false;
+        }
+
+    public:
+        static const int SLEEP_STEPS = 60;
+
+        const std::vector<int>& particle_island;
+        // (begin, end) pairs of consecutive awake particles
+        const std::vector<int>& awake_ranges;
+        // 1 for awake particles and 0 for sleeping ones, as taken by the collision passes
+        const std::vector<T>& mobility;
+        // bumped every time an island falls asleep or wakes up
+        const int& version;
+        const int& sleeping_count;
+        const T& sleep_velocity;
+
+        Islands() : _sleeping_count(0), _version(0), _dirty(false), _sleep_velocity(T(0.1)),
+            particle_island(_particle_island), awake_ranges(_awake_ranges), mobility(_mobility), version(_version),
+            sleeping_count(_sleeping_count), sleep_velocity(_sleep_velocity)
+        {
+        }
+
+        int island_count() const
+        {
+            return (int) _asleep.size();
+        }
+
+        bool Asleep(int island) const
+        {
+            return _asleep[island] != 0;
+        }
+
+        bool ParticleAsleep(int particle) const
+        {
+            return _asleep[_particle_island[particle]] != 0;
+        }
+
+        // Whether the island moved faster than the sleep velocity in the last measured step. Only moving
+        // islands wake the sleeping islands they touch, otherwise two resting neighbours would keep
+        // waking each other.
+        bool Moving(int island) const
+        {
+            return _still_steps[island] == 0;
+        }
+
+        // 0 disables sleeping, islands that are already asleep stay so until woken
+        void SetSleepVelocity(T velocity)
+        {
+            _sleep_velocity = velocity;
+        }
+
+        // Recomputing the islands after the pool topology changed takes a Begin, a Connect per constraint
+        // kind and a Finish. Every island starts awake.
+        void Begin(int particle_count)
+        {
+            _parent.resize(particle_count);
+            for (int p = 0; p < particle_count; ++p)
+            {
+                _parent[p] = p;
+            }
+        }
+
+        // Joins the particles of each constraint into one island
+        template <class Constraint>
+        void Connect(const Constraint* constraints, int count)
+        {
+            for (int c = 0; c < count; ++c)
+            {
+                int first = -1;
+                constraints[c].ForEachParticle([&](int particle) {
+                    if (first < 0)
+                    {
+                        first = particle;
+                    }
+                    else
+                    {
+                        Union(_parent, first, particle);
+                    }
+                });
+            }
+        }
+
+        void Finish()
+        {
+            std::vector<int>& parent = _parent;
+            int particle_count = (int) parent.size();
+
+            // number the roots, then counting-sort the particles by island
+            _particle_island.resize(particle_count);
+            int island_count = 0;
+            for (int p = 0; p < particle_count; ++p)
+            {
+                int root = Find(parent, p);
+                _particle_island[p] = (root == p) ? island_count++ : _particle_island[root];
+            }
+
+            _island_start.assign(island_count + 1, 0);
+            for (int p = 0; p < particle_count; ++p)
+            {
+                ++_island_start[_particle_island[p] + 1];
+            }
+            for (int i = 0; i < island_count; ++i)
+            {
+                _island_start[i + 1] += _island_start[i];
+            }
+            std::vector<int> fill(_island_start.begin(), _island_start.end() - 1);
+            _particles.resize(particle_count);
+            for (int p = 0; p < particle_count; ++p)
+            {
+                _particles[fill[_particle_island[p]]++] = p;
+            }
+
+            _still_steps.assign(island_count, 0);
+            _motion.assign(island_count, 0);
+            _asleep.assign(island_count, 0);
+            _sleeping_count = 0;
+            RebuildRanges();
+        }
+
+        // Wakes an island with zero velocity, so the drift it picked up from contacts while asleep is lost
+        void Wake(const ParticleArrays<T>& particles, int island)
+        {
+            if (!_asleep[island])
+            {
+                return;
+            }
+            for (int i = _island_start[island]; i < _island_start[island + 1]; ++i)
+            {
+                int p = _particles[i];
+                particles.last_x[p] = particles.x[p];
+                particles.last_y[p] = particles.y[p];
+            }
+            _asleep[island] = 0;
+            _still_steps[island] = 0;
+            --_sleeping_count;
+            _dirty = true;
+        }
+
+        void WakeAll(const ParticleArrays<T>& particles)
+        {
+            if (_sleeping_count == 0)
+            {
+                return;
+            }
+            for (int island = 0; island < island_count(); ++island)
+            {
+                Wake(particles, island);
+            }
+        }
+
+        // Rebuilds the awake ranges if islands were woken since the last call
+        void Refresh()
+        {
+            if (_dirty)
+            {
+                RebuildRanges();
+            }
+        }
+
+        // Measures how far the awake islands moved this step and updates their still counters.
+        // Call after the step, then Sleep once the wake-ups of this step are done.
+        void Measure(const ParticleArrays<T>& particles)
+        {
+            const T* x = particles.x;
+            const T* y = particles.y;
+            const T* last_x = particles.last_x;
+            const T* last_y = particles.last_y;
+
+            std::fill(_motion.begin(), _motion.end(), T(0));
+            for (size_t r = 0; r < _awake_ranges.size(); r += 2)
+            {
+                for (int p = _awake_ranges[r]; p < _awake_ranges[r + 1]; ++p)
+                {
+                    T dx = x[p] - last_x[p];
+                    T dy = y[p] - last_y[p];
+                    T& motion = _motion[_particle_island[p]];
+                    motion = std::max(motion, (dx * dx) + (dy * dy));
+                }
+            }
+
+            const T threshold = _sleep_velocity * _sleep_velocity;
+            for (int island = 0; island < island_count(); ++island)
+            {
+                if (!_asleep[island])
+                {
+                    _still_steps[island] = (_motion[island] < threshold) ? _still_steps[island] + 1 : 0;
+                }
+            }
+        }
+
+        // Puts the islands that have been still for long enough to sleep, then refreshes the awake ranges
+        void Sleep(const ParticleArrays<T>& particles)
+        {
+            for (int island = 0; island < island_count(); ++island)
+            {
+                if (!_asleep[island] && _still_steps[island] >= SLEEP_STEPS)
+                {
+                    for (int i = _island_start[island]; i < _island_start[island + 1]; ++i)
+                    {
+                        int p = _particles[i];
+                        particles.last_x[p] = particles.x[p];
+                        particles.last_y[p] = particles.y[p];
+                    }
+                    _asleep[island] = 1;
+                    ++_sleeping_count;
+                    _dirty = true;
+                }
+            }
+            Refresh();
+        }
+    };
+}
+
+
+#endif /* defined(____islands__) */
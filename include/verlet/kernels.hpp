@@ -0,0 +1,831 @@
+
+#ifndef ____kernels__
+#define ____kernels__
+
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VERLET_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "verlet/particle.hpp"
+#include "verlet/batches.hpp"
+
+
+namespace verlet
+{
+    namespace kernels
+    {
+        enum class SimdLevel
+        {
+            Scalar,
+            Sse,
+            Avx2
+        };
+
+        inline SimdLevel DetectSimdLevel()
+        {
+#ifdef VERLET_X86_KERNELS
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+            {
+                return SimdLevel::Avx2;
+            }
+            if (__builtin_cpu_supports("sse2"))
+            {
+                return SimdLevel::Sse;
+            }
+#endif
+            return SimdLevel::Scalar;
+        }
+
+        // Relaxes constraints [begin, end) of a batch in order. This is the reference implementation; the
+        // vector kernels below compute the exact same expression lane by lane. Every distance kernel also adds
+        // the violation each constraint had before its correction to residual, as a share of the rest length.
+        template <class T>
+        inline void RelaxDistanceScalar(const ParticleArrays<T>& particles, const DistanceBatchView<T>& batch,
+            int begin, int end, T stepCoeff, DistanceResidual<T>& residual)
+        {
+            T* x = particles.x;
+            T* y = particles.y;
+            for (int c = begin; c < end; ++c)
+            {
+                int p1 = batch.particle1[c];
+                int p2 = batch.particle2[c];
+                T normal_x = x[p1] - x[p2];
+                T normal_y = y[p1] - y[p2];
+                T normal_length_square = (normal_x * normal_x) + (normal_y * normal_y);
+                T error = (batch.distance_square[c] - normal_length_square)/normal_length_square;
+                residual.Add(error * T(0.5));
+                T factor = error * batch.stiffness[c] * stepCoeff;
+                normal_x *= factor;
+                normal_y *= factor;
+                x[p1] += normal_x;
+                y[p1] += normal_y;
+                x[p2] -= normal_x;
+                y[p2] -= normal_y;
+            }
+        }
+
+        // 1/sqrt(value) for the exact projection. Floats take the estimate the vector kernels use, refined by the
+        // same Newton step, so the scalar tail of a batch computes what its lanes do; other types take 1/sqrt.
+        template <class T>
+        inline T ReciprocalSqrt(T value)
+        {
+            return 1 / std::sqrt(value);
+        }
+
+        inline float ReciprocalSqrt(float value)
+        {
+#ifdef VERLET_X86_KERNELS
+            float estimate = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(value)));
+#else
+            // the bit level estimate is good to about 5 bits, with this extra Newton step the result ends near 17
+            uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            bits = 0x5f3759dfu - (bits >> 1);
+            float estimate;
+            std::memcpy(&estimate, &bits, sizeof(estimate));
+            estimate = estimate * (1.5f - (0.5f * value) * (estimate * estimate));
+#endif
+            // takes the 12 bits of rsqrtss to about 23
+            return estimate * (1.5f - (0.5f * value) * (estimate * estimate));
+        }
+
+        // Exact projection of constraints [begin, end) back to their rest length, each end moving in proportion
+        // to its inverse mass. stiffness is the fraction of the error removed per iteration, stepCoeff does
+        // not apply.
+        template <class T>
+        inline void RelaxDistanceExactScalar(const ParticleArrays<T>& particles, const DistanceBatchView<T>& batch,
+            int begin, int end, T stepCoeff, DistanceResidual<T>& residual)
+        {
+            T* x = particles.x;
+            T* y = particles.y;
+            const T* inverse_mass = particles.inverse_mass;
+            for (int c = begin; c < end; ++c)
+            {
+                int p1 = batch.particle1[c];
+                int p2 = batch.particle2[c];
+                T inverse_mass1 = inverse_mass[p1];
+                T inverse_mass2 = inverse_mass[p2];
+                T inverse_mass_sum = inverse_mass1 + inverse_mass2;
+                T normal_x = x[p1] - x[p2];
+                T normal_y = y[p1] - y[p2];
+                T normal_length_square = (normal_x * normal_x) + (normal_y * normal_y);
+                if (normal_length_square <= 0 || inverse_mass_sum <= 0)
+                {
+                    continue;
+                }
+                T error = (batch.distance[c] * ReciprocalSqrt(normal_length_square)) - 1;
+                residual.Add(error);
+                T factor = error * batch.stiffness[c] / inverse_mass_sum;
+                normal_x *= factor;
+                normal_y *= factor;
+                x[p1] += normal_x * inverse_mass1;
+                y[p1] += normal_y * inverse_mass1;
+                x[p2] -= normal_x * inverse_mass2;
+                y[p2] -= normal_y * inverse_mass2;
+            }
+        }
+
+        // XPBD projection of constraints [begin, end): each iteration adds to the constraint's Lagrange multiplier
+        // the change that satisfies C + compliance * lambda = 0, so for a given compliance the result converges to
+        // the same stretch whatever the iteration count. stiffness and stepCoeff do not apply.
+        template <class T>
+        inline void RelaxDistanceXpbdScalar(const ParticleArrays<T>& particles, const DistanceBatchView<T>& batch,
+            int begin, int end, T stepCoeff, DistanceResidual<T>& residual)
+        {
+            T* x = particles.x;
+            T* y = particles.y;
+            const T* inverse_mass = particles.inverse_mass;
+            for (int c = begin; c < end; ++c)
+            {
+                int p1 = batch.particle1[c];
+                int p2 = batch.particle2[c];
+                T inverse_mass1 = inverse_mass[p1];
+                T inverse_mass2 = inverse_mass[p2];
+                T compliance = batch.compliance[c] * batch.compliance_scale;
+                T denominator = inverse_mass1 + inverse_mass2 + compliance;
+                T normal_x = x[p1] - x[p2];
+                T normal_y = y[p1] - y[p2];
+                T normal_length_square = (normal_x * normal_x) + (normal_y * normal_y);
+                if (normal_length_square <= 0 || denominator <= 0)
+                {
+                    continue;
+                }
+                T length = std::sqrt(normal_length_square);
+                T error = (batch.distance[c] - length) - (compliance * batch.lambda[c]);
+                residual.Add(error / batch.distance[c]);
+                T delta_lambda = error / denominator;
+                batch.lambda[c] += delta_lambda;
+
+                T factor = delta_lambda / length;
+                normal_x *= factor;
+                normal_y *= factor;
+                x[p1] += normal_x * inverse_mass1;
+                y[p1] += normal_y * inverse_mass1;
+                x[p2] -= normal_x * inverse_mass2;
+                y[p2] -= normal_y * inverse_mass2;
+            }
+        }
+
+        // Relaxes angular constraints [begin, end) of a batch in order, the reference for the vector kernel
+        template <class T>
+        inline void RelaxAngularScalar(const ParticleArrays<T>& particles, const AngularBatchView<T>& batch,
+            int begin, int end, T stepCoeff)
+        {
+            for (int c = begin; c < end; ++c)
+            {
+                RelaxAngle(particles.x, particles.y, batch.particle1[c], batch.vertex[c], batch.particle2[c],
+                    batch.rest_cos[c], batch.rest_sin[c], batch.stiffness[c] * stepCoeff);
+            }
+        }
+
+        // XPBD relaxation of angular constraints [begin, end): the angle error C is projected along its gradient,
+        // weighted by inverse mass, with the multiplier of each constraint growing by the change that satisfies
+        // C + compliance * lambda = 0. Unlike RelaxAngle this is a first order step, the later iterations take
+        // up what it misses on large errors. The error needs an atan2, which is why this kernel has no vector
+        // version. stiffness and stepCoeff do not apply.
+        template <class T>
+        inline void RelaxAngularXpbdScalar(const ParticleArrays<T>& particles, const AngularBatchView<T>& batch,
+            int begin, int end, T stepCoeff)
+        {
+            T* x = particles.x;
+            T* y = particles.y;
+            const T* inverse_mass = particles.inverse_mass;
+            for (int c = begin; c < end; ++c)
+            {
+                int particle1 = batch.particle1[c];
+                int vertex = batch.vertex[c];
+                int particle2 = batch.particle2[c];
+                T a_x = x[particle1] - x[vertex];
+                T a_y = y[particle1] - y[vertex];
+                T b_x = x[particle2] - x[vertex];
+                T b_y = y[particle2] - y[vertex];
+                T a_length_square = (a_x * a_x) + (a_y * a_y);
+                T b_length_square = (b_x * b_x) + (b_y * b_y);
+                if (a_length_square == 0 || b_length_square == 0)
+                {
+                    continue;
+                }
+
+                // current angle from the particle1 arm to the particle2 arm minus the rest angle
+                T dot = (a_x * b_x) + (a_y * b_y);
+                T cross = (a_x * b_y) - (a_y * b_x);
+                T rest_cos = batch.rest_cos[c];
+                T rest_sin = batch.rest_sin[c];
+                T error = std::atan2((cross * rest_cos) - (dot * rest_sin), (dot * rest_cos) + (cross * rest_sin));
+
+                // gradients of the angle, the vertex one being minus their sum
+                T gradient1_x = a_y / a_length_square;
+                T gradient1_y = -a_x / a_length_square;
+                T gradient2_x = -b_y / b_length_square;
+                T gradient2_y = b_x / b_length_square;
+                T gradient_vertex_x = -(gradient1_x + gradient2_x);
+                T gradient_vertex_y = -(gradient1_y + gradient2_y);
+
+                T w1 = inverse_mass[particle1];
+                T w2 = inverse_mass[particle2];
+                T w_vertex = inverse_mass[vertex];
+                T weight = (w1 * (1 / a_length_square)) + (w2 * (1 / b_length_square))
+                    + (w_vertex * ((gradient_vertex_x * gradient_vertex_x) + (gradient_vertex_y * gradient_vertex_y)));
+                T compliance = batch.compliance[c] * batch.compliance_scale;
+                if (weight + compliance == 0)
+                {
+                    continue;
+                }
+                T delta_lambda = (-error - (compliance * batch.lambda[c])) / (weight + compliance);
+                batch.lambda[c] += delta_lambda;
+
+                x[particle1] += w1 * gradient1_x * delta_lambda;
+                y[particle1] += w1 * gradient1_y * delta_lambda;
+                x[particle2] += w2 * gradient2_x * delta_lambda;
+                y[particle2] += w2 * gradient2_y * delta_lambda;
+                x[vertex] += w_vertex * gradient_vertex_x * delta_lambda;
+                y[vertex] += w_vertex * gradient_vertex_y * delta_lambda;
+            }
+        }
+
+#ifdef VERLET_X86_KERNELS
+        // Adds the per lane maxima and sums of squared violations of a vector kernel to residual
+        inline void FoldResidual(DistanceResidual<float>& residual, const float* max, const float* sum_square,
+            int lanes, int count)
+        {
+            for (int lane = 0; lane < lanes; ++lane)
+            {
+                residual.max = std::max(residual.max, max[lane]);
+                residual.sum_square += sum_square[lane];
+            }
+            residual.count += count;
+        }
+
+        // 4 constraints per instruction. Only valid on a single color: lanes must not share particles.
+        inline void RelaxDistanceSse(const ParticleArrays<float>& particles, const DistanceBatchView<float>& batch,
+            int begin, int end, float stepCoeff, DistanceResidual<float>& residual)
+        {
+            float* x = particles.x;
+            float* y = particles.y;
+            const int* particle1 = batch.particle1;
+            const int* particle2 = batch.particle2;
+            const __m128 coeff = _mm_set1_ps(stepCoeff);
+            const __m128 half = _mm_set1_ps(0.5f);
+            const __m128 sign = _mm_set1_ps(-0.0f);
+            __m128 residual_max = _mm_setzero_ps();
+            __m128 residual_sum = _mm_setzero_ps();
+
+            int c = begin;
+            for (; c + 4 <= end; c += 4)
+            {
+                const int* a = particle1 + c;
+                const int* b = particle2 + c;
+                __m128 x1 = _mm_setr_ps(x[a[0]], x[a[1]], x[a[2]], x[a[3]]);
+                __m128 y1 = _mm_setr_ps(y[a[0]], y[a[1]], y[a[2]], y[a[3]]);
+                __m128 x2 = _mm_setr_ps(x[b[0]], x[b[1]], x[b[2]], x[b[3]]);
+                __m128 y2 = _mm_setr_ps(y[b[0]], y[b[1]], y[b[2]], y[b[3]]);
+
+                __m128 normal_x = _mm_sub_ps(x1, x2);
+                __m128 normal_y = _mm_sub_ps(y1, y2);
+                __m128 length_square = _mm_add_ps(_mm_mul_ps(normal_x, normal_x), _mm_mul_ps(normal_y, normal_y));
+                __m128 error = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(batch.distance_square + c), length_square),
+                    length_square);
+                __m128 violation = _mm_andnot_ps(sign, _mm_mul_ps(error, half));
+                residual_max = _mm_max_ps(residual_max, violation);
+                residual_sum = _mm_add_ps(residual_sum, _mm_mul_ps(violation, violation));
+                __m128 factor = _mm_mul_ps(_mm_mul_ps(error, _mm_loadu_ps(batch.stiffness + c)), coeff);
+                normal_x = _mm_mul_ps(normal_x, factor);
+                normal_y = _mm_mul_ps(normal_y, factor);
+
+                float out[4][4];
+                _mm_storeu_ps(out[0], _mm_add_ps(x1, normal_x));
+                _mm_storeu_ps(out[1], _mm_add_ps(y1, normal_y));
+                _mm_storeu_ps(out[2], _mm_sub_ps(x2, normal_x));
+                _mm_storeu_ps(out[3], _mm_sub_ps(y2, normal_y));
+                for (int lane = 0; lane < 4; ++lane)
+                {
+                    x[a[lane]] = out[0][lane];
+                    y[a[lane]] = out[1][lane];
+                    x[b[lane]] = out[2][lane];
+                    y[b[lane]] = out[3][lane];
+                }
+            }
+            float lanes_max[4], lanes_sum[4];
+            _mm_storeu_ps(lanes_max, residual_max);
+            _mm_storeu_ps(lanes_sum, residual_sum);
+            FoldResidual(residual, lanes_max, lanes_sum, 4, c - begin);
+            RelaxDistanceScalar(particles, batch, c, end, stepCoeff, residual);
+        }
+
+        // 8 constraints per instruction, gathering the endpoints. Same restriction as the SSE kernel.
+        __attribute__((target("avx2")))
+        inline void RelaxDistanceAvx2(const ParticleArrays<float>& particles, const DistanceBatchView<float>& batch,
+            int begin, int end, float stepCoeff, DistanceResidual<float>& residual)
+        {
+            float* x = particles.x;
+            float* y = particles.y;
+            const int* particle1 = batch.particle1;
+            const int* particle2 = batch.particle2;
+            const __m256 coeff = _mm256_set1_ps(stepCoeff);
+            const __m256 half = _mm256_set1_ps(0.5f);
+            const __m256 sign = _mm256_set1_ps(-0.0f);
+            __m256 residual_max = _mm256_setzero_ps();
+            __m256 residual_sum = _mm256_setzero_ps();
+
+            int c = begin;
+            for (; c + 8 <= end; c += 8)
+            {
+                const int* a = particle1 + c;
+                const int* b = particle2 + c;
+                __m256i index1 = _mm256_loadu_si256((const __m256i*) a);
+                __m256i index2 = _mm256_loadu_si256((const __m256i*) b);
+                __m256 x1 = _mm256_i32gather_ps(x, index1, 4);
+                __m256 y1 = _mm256_i32gather_ps(y, index1, 4);
+                __m256 x2 = _mm256_i32gather_ps(x, index2, 4);
+                __m256 y2 = _mm256_i32gather_ps(y, index2, 4);
+
+                __m256 normal_x = _mm256_sub_ps(x1, x2);
+                __m256 normal_y = _mm256_sub_ps(y1, y2);
+                __m256 length_square = _mm256_add_ps(_mm256_mul_ps(normal_x, normal_x),
+                    _mm256_mul_ps(normal_y, normal_y));
+                __m256 error = _mm256_div_ps(
+                    _mm256_sub_ps(_mm256_loadu_ps(batch.distance_square + c), length_square), length_square);
+                __m256 violation = _mm256_andnot_ps(sign, _mm256_mul_ps(error, half));
+                residual_max = _mm256_max_ps(residual_max, violation);
+                residual_sum = _mm256_add_ps(residual_sum, _mm256_mul_ps(violation, violation));
+                __m256 factor = _mm256_mul_ps(_mm256_mul_ps(error, _mm256_loadu_ps(batch.stiffness + c)), coeff);
+                normal_x = _mm256_mul_ps(normal_x, factor);
+                normal_y = _mm256_mul_ps(normal_y, factor);
+
+                // AVX2 has no scatter
+                float out[4][8];
+                _mm256_storeu_ps(out[0], _mm256_add_ps(x1, normal_x));
+                _mm256_storeu_ps(out[1], _mm256_add_ps(y1, normal_y));
+                _mm256_storeu_ps(out[2], _mm256_sub_ps(x2, normal_x));
+                _mm256_storeu_ps(out[3], _mm256_sub_ps(y2, normal_y));
+                for (int lane = 0; lane < 8; ++lane)
+                {
+                    x[a[lane]] = out[0][lane];
+                    y[a[lane]] = out[1][lane];
+                    x[b[lane]] = out[2][lane];
+                    y[b[lane]] = out[3][lane];
+                }
+            }
+            float lanes_max[8], lanes_sum[8];
+            _mm256_storeu_ps(lanes_max, residual_max);
+            _mm256_storeu_ps(lanes_sum, residual_sum);
+            FoldResidual(residual, lanes_max, lanes_sum, 8, c - begin);
+            RelaxDistanceScalar(particles, batch, c, end, stepCoeff, residual);
+        }
+
+        // Exact projection, 4 constraints per instruction
+        inline void RelaxDistanceExactSse(const ParticleArrays<float>& particles,
+            const DistanceBatchView<float>& batch, int begin, int end, float stepCoeff,
+            DistanceResidual<float>& residual)
+        {
+            float* x = particles.x;
+            float* y = particles.y;
+            const float* inverse_mass = particles.inverse_mass;
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 one = _mm_set1_ps(1);
+            const __m128 half = _mm_set1_ps(0.5f);
+            const __m128 three_halves = _mm_set1_ps(1.5f);
+            const __m128 sign = _mm_set1_ps(-0.0f);
+            __m128 residual_max = _mm_setzero_ps();
+            __m128 residual_sum = _mm_setzero_ps();
+            int counted = 0;
+
+            int c = begin;
+            for (; c + 4 <= end; c += 4)
+            {
+                const int* a = batch.particle1 + c;
+                const int* b = batch.particle2 + c;
+                __m128 x1 = _mm_setr_ps(x[a[0]], x[a[1]], x[a[2]], x[a[3]]);
+                __m128 y1 = _mm_setr_ps(y[a[0]], y[a[1]], y[a[2]], y[a[3]]);
+                __m128 x2 = _mm_setr_ps(x[b[0]], x[b[1]], x[b[2]], x[b[3]]);
+                __m128 y2 = _mm_setr_ps(y[b[0]], y[b[1]], y[b[2]], y[b[3]]);
+                __m128 inverse_mass1 = _mm_setr_ps(inverse_mass[a[0]], inverse_mass[a[1]], inverse_mass[a[2]],
+                    inverse_mass[a[3]]);
+                __m128 inverse_mass2 = _mm_setr_ps(inverse_mass[b[0]], inverse_mass[b[1]], inverse_mass[b[2]],
+                    inverse_mass[b[3]]);
+                __m128 inverse_mass_sum = _mm_add_ps(inverse_mass1, inverse_mass2);
+
+                __m128 normal_x = _mm_sub_ps(x1, x2);
+                __m128 normal_y = _mm_sub_ps(y1, y2);
+                __m128 length_square = _mm_add_ps(_mm_mul_ps(normal_x, normal_x), _mm_mul_ps(normal_y, normal_y));
+
+                // one Newton step takes the estimate from 12 to about 23 bits
+                __m128 inverse_length = _mm_rsqrt_ps(length_square);
+                inverse_length = _mm_mul_ps(inverse_length, _mm_sub_ps(three_halves,
+                    _mm_mul_ps(_mm_mul_ps(half, length_square), _mm_mul_ps(inverse_length, inverse_length))));
+
+                __m128 valid = _mm_and_ps(_mm_cmpgt_ps(length_square, zero), _mm_cmpgt_ps(inverse_mass_sum, zero));
+                __m128 error = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(batch.distance + c), inverse_length), one);
+                __m128 violation = _mm_and_ps(_mm_andnot_ps(sign, error), valid);
+                counted += __builtin_popcount(_mm_movemask_ps(valid));
+                residual_max = _mm_max_ps(residual_max, violation);
+                residual_sum = _mm_add_ps(residual_sum, _mm_mul_ps(violation, violation));
+                __m128 factor = _mm_div_ps(_mm_mul_ps(error, _mm_loadu_ps(batch.stiffness + c)), inverse_mass_sum);
+                factor = _mm_and_ps(factor, valid);
+                normal_x = _mm_mul_ps(normal_x, factor);
+                normal_y = _mm_mul_ps(normal_y, factor);
+
+                float out[4][4];
+                _mm_storeu_ps(out[0], _mm_add_ps(x1, _mm_mul_ps(normal_x, inverse_mass1)));
+                _mm_storeu_ps(out[1], _mm_add_ps(y1, _mm_mul_ps(normal_y, inverse_mass1)));
+                _mm_storeu_ps(out[2], _mm_sub_ps(x2, _mm_mul_ps(normal_x, inverse_mass2)));
+                _mm_storeu_ps(out[3], _mm_sub_ps(y2, _mm_mul_ps(normal_y, inverse_mass2)));
+                for (int lane = 0; lane < 4; ++lane)
+                {
+                    x[a[lane]] = out[0][lane];
+                    y[a[lane]] = out[1][lane];
+                    x[b[lane]] = out[2][lane];
+                    y[b[lane]] = out[3][lane];
+                }
+            }
+            float lanes_max[4], lanes_sum[4];
+            _mm_storeu_ps(lanes_max, residual_max);
+            _mm_storeu_ps(lanes_sum, residual_sum);
+            FoldResidual(residual, lanes_max, lanes_sum, 4, counted);
+            RelaxDistanceExactScalar(particles, batch, c, end, stepCoeff, residual);
+        }
+
+        // Exact projection, 8 constraints per instruction
+        __attribute__((target("avx2")))
+        inline void RelaxDistanceExactAvx2(const ParticleArrays<float>& particles,
+            const DistanceBatchView<float>& batch, int begin, int end, float stepCoeff,
+            DistanceResidual<float>& residual)
+        {
+            float* x = particles.x;
+            float* y = particles.y;
+            const float* inverse_mass = particles.inverse_mass;
+            const __m256 zero = _mm256_setzero_ps();
+            const __m256 one = _mm256_set1_ps(1);
+            const __m256 half = _mm256_set1_ps(0.5f);
+            const __m256 three_halves = _mm256_set1_ps(1.5f);
+            const __m256 sign = _mm256_set1_ps(-0.0f);
+            __m256 residual_max = _mm256_setzero_ps();
+            __m256 residual_sum = _mm256_setzero_ps();
+            int counted = 0;
+
+            int c = begin;
+            for (; c + 8 <= end; c += 8)
+            {
+                const int* a = batch.particle1 + c;
+                const int* b = batch.particle2 + c;
+                __m256i index1 = _mm256_loadu_si256((const __m256i*) a);
+                __m256i index2 = _mm256_loadu_si256((const __m256i*) b);
+                __m256 x1 = _mm256_i32gather_ps(x, index1, 4);
+                __m256 y1 = _mm256_i32gather_ps(y, index1, 4);
+                __m256 x2 = _mm256_i32gather_ps(x, index2, 4);
+                __m256 y2 = _mm256_i32gather_ps(y, index2, 4);
+                __m256 inverse_mass1 = _mm256_i32gather_ps(inverse_mass, index1, 4);
+                __m256 inverse_mass2 = _mm256_i32gather_ps(inverse_mass, index2, 4);
+                __m256 inverse_mass_sum = _mm256_add_ps(inverse_mass1, inverse_mass2);
+
+                __m256 normal_x = _mm256_sub_ps(x1, x2);
+                __m256 normal_y = _mm256_sub_ps(y1, y2);
+                __m256 length_square = _mm256_add_ps(_mm256_mul_ps(normal_x, normal_x),
+                    _mm256_mul_ps(normal_y, normal_y));
+
+                __m256 inverse_length = _mm256_rsqrt_ps(length_square);
+                inverse_length = _mm256_mul_ps(inverse_length, _mm256_sub_ps(three_halves, _mm256_mul_ps(
+                    _mm256_mul_ps(half, length_square), _mm256_mul_ps(inverse_length, inverse_length))));
+
+                __m256 valid = _mm256_and_ps(_mm256_cmp_ps(length_square, zero, _CMP_GT_OQ),
+                    _mm256_cmp_ps(inverse_mass_sum, zero, _CMP_GT_OQ));
+                __m256 error = _mm256_sub_ps(_mm256_mul_ps(_mm256_loadu_ps(batch.distance + c), inverse_length),
+                    one);
+                __m256 violation = _mm256_and_ps(_mm256_andnot_ps(sign, error), valid);
+                counted += __builtin_popcount(_mm256_movemask_ps(valid));
+                residual_max = _mm256_max_ps(residual_max, violation);
+                residual_sum = _mm256_add_ps(residual_sum, _mm256_mul_ps(violation, violation));
+                __m256 factor = _mm256_div_ps(_mm256_mul_ps(error, _mm256_loadu_ps(batch.stiffness + c)),
+                    inverse_mass_sum);
+                factor = _mm256_and_ps(factor, valid);
+                normal_x = _mm256_mul_ps(normal_x, factor);
+                normal_y = _mm256_mul_ps(normal_y, factor);
+
+                float out[4][8];
+                _mm256_storeu_ps(out[0], _mm256_add_ps(x1, _mm256_mul_ps(normal_x, inverse_mass1)));
+                _mm256_storeu_ps(out[1], _mm256_add_ps(y1, _mm256_mul_ps(normal_y, inverse_mass1)));
+                _mm256_storeu_ps(out[2], _mm256_sub_ps(x2, _mm256_mul_ps(normal_x, inverse_mass2)));
+                _mm256_storeu_ps(out[3], _mm256_sub_ps(y2, _mm256_mul_ps(normal_y, inverse_mass2)));
+                for (int lane = 0; lane < 8; ++lane)
+                {
+                    x[a[lane]] = out[0][lane];
+                    y[a[lane]] = out[1][lane];
+                    x[b[lane]] = out[2][lane];
+                    y[b[lane]] = out[3][lane];
+                }
+            }
+            float lanes_max[8], lanes_sum[8];
+            _mm256_storeu_ps(lanes_max, residual_max);
+            _mm256_storeu_ps(lanes_sum, residual_sum);
+            FoldResidual(residual, lanes_max, lanes_sum, 8, counted);
+            RelaxDistanceExactScalar(particles, batch, c, end, stepCoeff, residual);
+        }
+
+        // XPBD projection, 8 constraints per instruction, matching the scalar kernel bit for bit
+        __attribute__((target("avx2")))
+        inline void RelaxDistanceXpbdAvx2(const ParticleArrays<float>& particles,
+            const DistanceBatchView<float>& batch, int begin, int end, float stepCoeff,
+            DistanceResidual<float>& residual)
+        {
+            float* x = particles.x;
+            float* y = particles.y;
+            const float* inverse_mass = particles.inverse_mass;
+            const __m256 zero = _mm256_setzero_ps();
+            const __m256 compliance_scale = _mm256_set1_ps(batch.compliance_scale);
+            const __m256 sign = _mm256_set1_ps(-0.0f);
+            __m256 residual_max = _mm256_setzero_ps();
+            __m256 residual_sum = _mm256_setzero_ps();
+            int counted = 0;
+
+            int c = begin;
+            for (; c + 8 <= end; c += 8)
+            {
+                const int* a = batch.particle1 + c;
+                const int* b = batch.particle2 + c;
+                __m256i index1 = _mm256_loadu_si256((const __m256i*) a);
+                __m256i index2 = _mm256_loadu_si256((const __m256i*) b);
+                __m256 x1 = _mm256_i32gather_ps(x, index1, 4);
+                __m256 y1 = _mm256_i32gather_ps(y, index1, 4);
+                __m256 x2 = _mm256_i32gather_ps(x, index2, 4);
+                __m256 y2 = _mm256_i32gather_ps(y, index2, 4);
+                __m256 inverse_mass1 = _mm256_i32gather_ps(inverse_mass, index1, 4);
+                __m256 inverse_mass2 = _mm256_i32gather_ps(inverse_mass, index2, 4);
+                __m256 compliance = _mm256_mul_ps(_mm256_loadu_ps(batch.compliance + c), compliance_scale);
+                __m256 lambda = _mm256_loadu_ps(batch.lambda + c);
+                __m256 denominator = _mm256_add_ps(_mm256_add_ps(inverse_mass1, inverse_mass2), compliance);
+
+                __m256 normal_x = _mm256_sub_ps(x1, x2);
+                __m256 normal_y = _mm256_sub_ps(y1, y2);
+                __m256 length_square = _mm256_add_ps(_mm256_mul_ps(normal_x, normal_x),
+                    _mm256_mul_ps(normal_y, normal_y));
+                __m256 valid = _mm256_and_ps(_mm256_cmp_ps(length_square, zero, _CMP_GT_OQ),
+                    _mm256_cmp_ps(denominator, zero, _CMP_GT_OQ));
+
+                __m256 length = _mm256_sqrt_ps(length_square);
+                __m256 rest_length = _mm256_loadu_ps(batch.distance + c);
+                __m256 error = _mm256_sub_ps(_mm256_sub_ps(rest_length, length), _mm256_mul_ps(compliance, lambda));
+                __m256 violation = _mm256_and_ps(_mm256_andnot_ps(sign, _mm256_div_ps(error, rest_length)), valid);
+                counted += __builtin_popcount(_mm256_movemask_ps(valid));
+                residual_max = _mm256_max_ps(residual_max, violation);
+                residual_sum = _mm256_add_ps(residual_sum, _mm256_mul_ps(violation, violation));
+                __m256 delta_lambda = _mm256_div_ps(error, denominator);
+                delta_lambda = _mm256_and_ps(delta_lambda, valid);
+                _mm256_storeu_ps(batch.lambda + c, _mm256_add_ps(lambda, delta_lambda));
+
+                __m256 factor = _mm256_and_ps(_mm256_div_ps(delta_lambda, length), valid);
+                normal_x = _mm256_mul_ps(normal_x, factor);
+                normal_y = _mm256_mul_ps(normal_y, factor);
+
+                float out[4][8];
+                _mm256_storeu_ps(out[0], _mm256_add_ps(x1, _mm256_mul_ps(normal_x, inverse_mass1)));
+                _mm256_storeu_ps(out[1], _mm256_add_ps(y1, _mm256_mul_ps(normal_y, inverse_mass1)));
+                _mm256_storeu_ps(out[2], _mm256_sub_ps(x2, _mm256_mul_ps(normal_x, inverse_mass2)));
+                _mm256_storeu_ps(out[3], _mm256_sub_ps(y2, _mm256_mul_ps(normal_y, inverse_mass2)));
+                for (int lane = 0; lane < 8; ++lane)
+                {
+                    x[a[lane]] = out[0][lane];
+                    y[a[lane]] = out[1][lane];
+                    x[b[lane]] = out[2][lane];
+                    y[b[lane]] = out[3][lane];
+                }
+            }
+            float lanes_max[8], lanes_sum[8];
+            _mm256_storeu_ps(lanes_max, residual_max);
+            _mm256_storeu_ps(lanes_sum, residual_sum);
+            FoldResidual(residual, lanes_max, lanes_sum, 8, counted);
+            RelaxDistanceXpbdScalar(particles, batch, c, end, stepCoeff, residual);
+        }
+
+        // RelaxAngle on 8 angular constraints of one color at a time
+        __attribute__((target("avx2")))
+        inline void RelaxAngularAvx2(const ParticleArrays<float>& particles, const AngularBatchView<float>& batch,
+            int begin, int end, float stepCoeff)
+        {
+            float* x = particles.x;
+            float* y = particles.y;
+            const __m256 coeff = _mm256_set1_ps(stepCoeff);
+            const __m256 one = _mm256_set1_ps(1);
+            const __m256 zero = _mm256_setzero_ps();
+
+            int c = begin;
+            for (; c + 8 <= end; c += 8)
+            {
+                const int* a = batch.particle1 + c;
+                const int* v = batch.vertex + c;
+                const int* b = batch.particle2 + c;
+                __m256i index1 = _mm256_loadu_si256((const __m256i*) a);
+                __m256i vertex_index = _mm256_loadu_si256((const __m256i*) v);
+                __m256i index2 = _mm256_loadu_si256((const __m256i*) b);
+                __m256 vertex_x = _mm256_i32gather_ps(x, vertex_index, 4);
+                __m256 vertex_y = _mm256_i32gather_ps(y, vertex_index, 4);
+                __m256 a_x = _mm256_sub_ps(_mm256_i32gather_ps(x, index1, 4), vertex_x);
+                __m256 a_y = _mm256_sub_ps(_mm256_i32gather_ps(y, index1, 4), vertex_y);
+                __m256 b_x = _mm256_sub_ps(_mm256_i32gather_ps(x, index2, 4), vertex_x);
+                __m256 b_y = _mm256_sub_ps(_mm256_i32gather_ps(y, index2, 4), vertex_y);
+
+                __m256 dot = _mm256_add_ps(_mm256_mul_ps(a_x, b_x), _mm256_mul_ps(a_y, b_y));
+                __m256 cross = _mm256_sub_ps(_mm256_mul_ps(a_x, b_y), _mm256_mul_ps(a_y, b_x));
+                __m256 length = _mm256_sqrt_ps(_mm256_mul_ps(
+                    _mm256_add_ps(_mm256_mul_ps(a_x, a_x), _mm256_mul_ps(a_y, a_y)),
+                    _mm256_add_ps(_mm256_mul_ps(b_x, b_x), _mm256_mul_ps(b_y, b_y))));
+
+                __m256 rest_cos = _mm256_loadu_ps(batch.rest_cos + c);
+                __m256 rest_sin = _mm256_loadu_ps(batch.rest_sin + c);
+                __m256 k = _mm256_mul_ps(_mm256_loadu_ps(batch.stiffness + c), coeff);
+                __m256 rotation_x = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(one, k), length),
+                    _mm256_mul_ps(k, _mm256_add_ps(_mm256_mul_ps(dot, rest_cos), _mm256_mul_ps(cross, rest_sin))));
+                __m256 rotation_y = _mm256_mul_ps(k,
+                    _mm256_sub_ps(_mm256_mul_ps(cross, rest_cos), _mm256_mul_ps(dot, rest_sin)));
+                __m256 rotation_length_square = _mm256_add_ps(_mm256_mul_ps(rotation_x, rotation_x),
+                    _mm256_mul_ps(rotation_y, rotation_y));
+
+                // lanes without a direction keep the identity rotation, as in RelaxAngle
+                __m256 valid = _mm256_cmp_ps(rotation_length_square, zero, _CMP_GT_OQ);
+                __m256 inverse_length = _mm256_div_ps(one, _mm256_sqrt_ps(rotation_length_square));
+                __m256 cosine = _mm256_blendv_ps(one, _mm256_mul_ps(rotation_x, inverse_length), valid);
+                __m256 sine = _mm256_blendv_ps(zero, _mm256_mul_ps(rotation_y, inverse_length), valid);
+
+                __m256 position1_x = _mm256_add_ps(
+                    _mm256_sub_ps(_mm256_mul_ps(a_x, cosine), _mm256_mul_ps(a_y, sine)), vertex_x);
+                __m256 position1_y = _mm256_add_ps(
+                    _mm256_add_ps(_mm256_mul_ps(a_x, sine), _mm256_mul_ps(a_y, cosine)), vertex_y);
+                __m256 position2_x = _mm256_add_ps(
+                    _mm256_add_ps(_mm256_mul_ps(b_x, cosine), _mm256_mul_ps(b_y, sine)), vertex_x);
+                __m256 position2_y = _mm256_add_ps(
+                    _mm256_sub_ps(_mm256_mul_ps(b_y, cosine), _mm256_mul_ps(b_x, sine)), vertex_y);
+
+                __m256 d_x = _mm256_sub_ps(vertex_x, position1_x);
+                __m256 d_y = _mm256_sub_ps(vertex_y, position1_y);
+                vertex_x = _mm256_add_ps(
+                    _mm256_sub_ps(_mm256_mul_ps(d_x, cosine), _mm256_mul_ps(d_y, sine)), position1_x);
+                vertex_y = _mm256_add_ps(
+                    _mm256_add_ps(_mm256_mul_ps(d_x, sine), _mm256_mul_ps(d_y, cosine)), position1_y);
+                d_x = _mm256_sub_ps(vertex_x, position2_x);
+                d_y = _mm256_sub_ps(vertex_y, position2_y);
+                vertex_x = _mm256_add_ps(
+                    _mm256_add_ps(_mm256_mul_ps(d_x, cosine), _mm256_mul_ps(d_y, sine)), position2_x);
+                vertex_y = _mm256_add_ps(
+                    _mm256_sub_ps(_mm256_mul_ps(d_y, cosine), _mm256_mul_ps(d_x, sine)), position2_y);
+
+                float out[6][8];
+                _mm256_storeu_ps(out[0], position1_x);
+                _mm256_storeu_ps(out[1], position1_y);
+                _mm256_storeu_ps(out[2], position2_x);
+                _mm256_storeu_ps(out[3], position2_y);
+                _mm256_storeu_ps(out[4], vertex_x);
+                _mm256_storeu_ps(out[5], vertex_y);
+                for (int lane = 0; lane < 8; ++lane)
+                {
+                    x[a[lane]] = out[0][lane];
+                    y[a[lane]] = out[1][lane];
+                    x[b[lane]] = out[2][lane];
+                    y[b[lane]] = out[3][lane];
+                    x[v[lane]] = out[4][lane];
+                    y[v[lane]] = out[5][lane];
+                }
+            }
+            RelaxAngularScalar(particles, batch, c, end, stepCoeff);
+        }
+#endif
+
+        template <class T>
+        struct DistanceKernel
+        {
+            typedef void (*Function)(const ParticleArrays<T>&, const DistanceBatchView<T>&, int, int, T,
+                DistanceResidual<T>&);
+
+            static Function Select(SimdLevel level)
+            {
+                return &RelaxDistanceScalar<T>;
+            }
+        };
+
+#ifdef VERLET_X86_KERNELS
+        template <>
+        struct DistanceKernel<float>
+        {
+            typedef void (*Function)(const ParticleArrays<float>&, const DistanceBatchView<float>&, int, int, float,
+                DistanceResidual<float>&);
+
+            static Function Select(SimdLevel level)
+            {
+                switch (level)
+                {
+                    case SimdLevel::Avx2:
+                        return &RelaxDistanceAvx2;
+                    case SimdLevel::Sse:
+                        return &RelaxDistanceSse;
+                    default:
+                        return &RelaxDistanceScalar<float>;
+                }
+            }
+        };
+#endif
+
+        template <class T>
+        struct ExactDistanceKernel
+        {
+            typedef void (*Function)(const ParticleArrays<T>&, const DistanceBatchView<T>&, int, int, T,
+                DistanceResidual<T>&);
+
+            static Function Select(SimdLevel level)
+            {
+                return &RelaxDistanceExactScalar<T>;
+            }
+        };
+
+#ifdef VERLET_X86_KERNELS
+        template <>
+        struct ExactDistanceKernel<float>
+        {
+            typedef void (*Function)(const ParticleArrays<float>&, const DistanceBatchView<float>&, int, int, float,
+                DistanceResidual<float>&);
+
+            static Function Select(SimdLevel level)
+            {
+                switch (level)
+                {
+                    case SimdLevel::Avx2:
+                        return &RelaxDistanceExactAvx2;
+                    case SimdLevel::Sse:
+                        return &RelaxDistanceExactSse;
+                    default:
+                        return &RelaxDistanceExactScalar<float>;
+                }
+            }
+        };
+#endif
+
+        template <class T>
+        struct XpbdDistanceKernel
+        {
+            typedef void (*Function)(const ParticleArrays<T>&, const DistanceBatchView<T>&, int, int, T,
+                DistanceResidual<T>&);
+
+            static Function Select(SimdLevel level)
+            {
+                return &RelaxDistanceXpbdScalar<T>;
+            }
+        };
+
+#ifdef VERLET_X86_KERNELS
+        template <>
+        struct XpbdDistanceKernel<float>
+        {
+            typedef void (*Function)(const ParticleArrays<float>&, const DistanceBatchView<float>&, int, int, float,
+                DistanceResidual<float>&);
+
+            static Function Select(SimdLevel level)
+            {
+                return (level == SimdLevel::Avx2) ? &RelaxDistanceXpbdAvx2 : &RelaxDistanceXpbdScalar<float>;
+            }
+        };
+#endif
+
+        // Only AVX2 has a vector angular kernel, the gathers are what makes it pay off
+        template <class T>
+        struct AngularKernel
+        {
+            typedef void (*Function)(const ParticleArrays<T>&, const AngularBatchView<T>&, int, int, T);
+
+            static Function Select(SimdLevel level)
+            {
+                return &RelaxAngularScalar<T>;
+            }
+        };
+
+#ifdef VERLET_X86_KERNELS
+        template <>
+        struct AngularKernel<float>
+        {
+            typedef void (*Function)(const ParticleArrays<float>&, const AngularBatchView<float>&, int, int, float);
+
+            static Function Select(SimdLevel level)
+            {
+                return (level == SimdLevel::Avx2) ? &RelaxAngularAvx2 : &RelaxAngularScalar<float>;
+            }
+        };
+#endif
+
+        template <class T>
+        struct XpbdAngularKernel
+        {
+            typedef typename AngularKernel<T>::Function Function;
+
+            static Function Select(SimdLevel level)
+            {
+                return &RelaxAngularXpbdScalar<T>;
+            }
+        };
+    }
+}
+
+
+#endif /* defined(____kernels__) */
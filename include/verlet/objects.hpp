@@ -15,28 +15,29 @@ namespace simulation {
 
     using namespace verlet;
 
-    template<class T> Composite<T>* Point(math::Vector2d<T>& position, ObjectPool<T>* object_pool)
+    template<class T, class... Extra> Composite<T>* Point(math::Vector2d<T>& position, ObjectPool<T, Extra...>* object_pool)
     {
         static_assert(std::is_floating_point<T>::value,
               "Point can be of floating point data types only");
 
         if (object_pool->CanAllocate(1, 0, 0, 0, 1))
         {
-            Particle<T>* particle = object_pool->AllocateParticles(1);
+            int particle = object_pool->AllocateParticles(1);
             Composite<T>* composite = object_pool->AllocateComposites(1);
 
-            *particle = Particle<T>(position);
+            object_pool->particles.Set(particle, Particle<T>(position));
             *composite = Composite<T>();
+            composite->SetParticles(IndexRange(particle, 1));
 
-            composite->AddParticle(particle);
             return composite;
         }
         return nullptr;
     }
 
-    template<class T> Composite<T>* LineSegments(std::vector<math::Vector2d<T> >& vertices,
+    // compliance is given to every distance constraint of the builders below, for DistanceMode::Xpbd
+    template<class T, class... Extra> Composite<T>* LineSegments(std::vector<math::Vector2d<T> >& vertices,
         std::vector<int> pin_particle_indexes, math::Vector2d<T>& position_offset, T stiffness, 
-        ObjectPool<T>* object_pool)
+        ObjectPool<T, Extra...>* object_pool, T compliance = 0)
     {
         static_assert(std::is_floating_point<T>::value,
               "LineSegments can be of floating point data types only");
@@ -47,36 +48,41 @@ namespace simulation {
         if (object_pool->CanAllocate(vertex_count, pin_constraints_count, vertex_count-1, 0, 1))
         {
             Composite<T>* composite = object_pool->AllocateComposites(1);
-            Particle<T>* particles = object_pool->AllocateParticles(vertex_count);
+            int first_particle = object_pool->AllocateParticles(vertex_count);
             PinConstraint<T>* pin_constraints = object_pool->AllocatePinConstraints(pin_constraints_count);
             DistanceConstraint<T>* distance_constraints = object_pool->AllocateDistanceConstraints(vertex_count-1);
 
+            const ParticleArrays<T>& particles = object_pool->particles;
             *composite = Composite<T>();
-            Particle<T>* prev_particle = &particles[0];
-            Particle<T>* particle = &particles[1];
+            composite->SetParticles(IndexRange(first_particle, vertex_count));
+            composite->SetConstraints(PIN_CONSTRAINT,
+                IndexRange(object_pool->Index(pin_constraints), pin_constraints_count));
+            composite->SetConstraints(DISTANCE_CONSTRAINT,
+                IndexRange(object_pool->Index(distance_constraints), vertex_count - 1));
+            int prev_particle = first_particle;
+            int particle = first_particle + 1;
             DistanceConstraint<T>* distance_constraint = &distance_constraints[0];
 
             auto it = vertices.begin();
             math::Vector2d<T> actual_position = (*it) + position_offset;
-            *prev_particle = Particle<T>(actual_position);
-            composite->AddParticle(prev_particle);
+            particles.Set(prev_particle, Particle<T>(actual_position));
 
             for (++it; it != vertices.end(); ++it, ++particle, ++distance_constraint)
             {
                 actual_position = (*it) + position_offset;
-                *particle = Particle<T>(actual_position);
-                composite->AddParticle(particle);
+                particles.Set(particle, Particle<T>(actual_position));
 
-                *distance_constraint = DistanceConstraint<T> (prev_particle, particle, stiffness);
-                composite->AddConstraint(distance_constraint);
+                *distance_constraint = DistanceConstraint<T> (particles, prev_particle, particle, stiffness,
+                    compliance);
                 prev_particle = particle;
             }
 
             PinConstraint<T>* pin_constraint = &pin_constraints[0];
             for(auto it = pin_particle_indexes.begin(); it != pin_particle_indexes.end(); ++it, ++pin_constraint)
             {
-                *pin_constraint = PinConstraint<T>(&particles[*it], particles[*it].position);
-                composite->AddConstraint(pin_constraint);
+                int pinned = first_particle + *it;
+                *pin_constraint = PinConstraint<T>(pinned, particles.Position(pinned));
+                particles.inverse_mass[pinned] = 0;
             }
 
             return composite;
@@ -84,9 +90,9 @@ namespace simulation {
         return nullptr;
     }
 
-    template<class T> Composite<T>* Polygon(std::vector<math::Vector2d<T> >& vertices, 
+    template<class T, class... Extra> Composite<T>* Polygon(std::vector<math::Vector2d<T> >& vertices, 
         std::vector<std::pair<int, int> >& constraint_pairs, math::Vector2d<T>& position_offset,
-        T stiffness, ObjectPool<T>* object_pool)
+        T stiffness, ObjectPool<T, Extra...>* object_pool, T compliance = 0)
     {
         static_assert(std::is_floating_point<T>::value,
               "Polygon can be of floating point data types only");
@@ -97,68 +103,71 @@ namespace simulation {
         if (object_pool->CanAllocate(vertex_count, 0, constraints_count, 0, 1))
         {
             Composite<T>* composite = object_pool->AllocateComposites(1);
-            Particle<T>* particles = object_pool->AllocateParticles(vertex_count);
+            int first_particle = object_pool->AllocateParticles(vertex_count);
             DistanceConstraint<T>* distance_constraints = object_pool->AllocateDistanceConstraints(constraints_count);
 
+            const ParticleArrays<T>& particles = object_pool->particles;
             *composite = Composite<T>();
-            Particle<T>* particle = &particles[0];
+            composite->SetParticles(IndexRange(first_particle, vertex_count));
+            composite->SetConstraints(DISTANCE_CONSTRAINT,
+                IndexRange(object_pool->Index(distance_constraints), constraints_count));
+            int particle = first_particle;
             for (auto it = vertices.begin(); it != vertices.end(); ++it, ++particle)
             {
                 math::Vector2d<T> actual_position = (*it) + position_offset;
-                *particle = Particle<T>(actual_position);
-                composite->AddParticle(particle);
+                particles.Set(particle, Particle<T>(actual_position));
             }
 
             DistanceConstraint<T>* distance_constraint = &distance_constraints[0];
             for(auto it = constraint_pairs.begin(); it != constraint_pairs.end(); ++it, ++distance_constraint)
             {
-                *distance_constraint = DistanceConstraint<T>(&particles[it->first], &particles[it->second], stiffness);
-                composite->AddConstraint(distance_constraint);
+                *distance_constraint = DistanceConstraint<T>(particles, first_particle + it->first,
+                    first_particle + it->second, stiffness, compliance);
             }
             return composite;
         }
         return nullptr;
     }
 
-    template<class T> Composite<T>* Tire(math::Vector2d<T>& origin, T radius, int segments,
-        T spoke_stiffness, T tread_stiffness, ObjectPool<T>* object_pool)
+    template<class T, class... Extra> Composite<T>* Tire(math::Vector2d<T>& origin, T radius, int segments,
+        T spoke_stiffness, T tread_stiffness, ObjectPool<T, Extra...>* object_pool, T compliance = 0)
     {
         if (object_pool->CanAllocate(segments + 1, 0, segments * 3, 0, 1))
         {
             T stride = (2 * M_PI)/segments;
             Composite<T>* composite = object_pool->AllocateComposites(1);
-            Particle<T>* particles = object_pool->AllocateParticles(segments + 1);
+            int first_particle = object_pool->AllocateParticles(segments + 1);
             DistanceConstraint<T>* distance_constraints = object_pool->AllocateDistanceConstraints(segments * 3);
 
             // particles
+            const ParticleArrays<T>& particles = object_pool->particles;
             *composite = Composite<T>();
-            Particle<T>* particle = &particles[0];
+            composite->SetParticles(IndexRange(first_particle, segments + 1));
+            composite->SetConstraints(DISTANCE_CONSTRAINT,
+                IndexRange(object_pool->Index(distance_constraints), segments * 3));
+            int particle = first_particle;
             for (int i=0; i < segments; ++i, ++particle)
             {
                 T theta = i * stride;
                 math::Vector2d<T> position(origin.x + cos(theta)*radius, origin.y + sin(theta)*radius);
-                *particle = Particle<T>(position);
-                composite->AddParticle(particle);
+                particles.Set(particle, Particle<T>(position));
             }
-            *particle = Particle<T>(origin);
-            composite->AddParticle(particle);
+            particles.Set(particle, Particle<T>(origin));
 
             // constraints
             DistanceConstraint<T>* distance_constraint = &distance_constraints[0];
             for (int i = 0; i < segments; ++i)
             {
-                *distance_constraint = DistanceConstraint<T>(&particles[i], &particles[(i+1) % segments],
-                    tread_stiffness);
-                composite->AddConstraint(distance_constraint);
+                *distance_constraint = DistanceConstraint<T>(particles, first_particle + i,
+                    first_particle + (i+1) % segments, tread_stiffness, compliance);
                 distance_constraint++;
 
-                *distance_constraint = DistanceConstraint<T>(&particles[i], particle, spoke_stiffness);
-                composite->AddConstraint(distance_constraint);
+                *distance_constraint = DistanceConstraint<T>(particles, first_particle + i, particle,
+                    spoke_stiffness, compliance);
                 distance_constraint++;
 
-                *distance_constraint = DistanceConstraint<T>(&particles[i], &particles[(i+5) % segments],
-                    tread_stiffness);
-                composite->AddConstraint(distance_constraint);
+                *distance_constraint = DistanceConstraint<T>(particles, first_particle + i,
+                    first_particle + (i+5) % segments, tread_stiffness, compliance);
                 distance_constraint++;
             }
             return composite;
@@ -166,17 +175,24 @@ namespace simulation {
         return nullptr;
     }
 
-    template<class T> Composite<T>* Cloth(math::Vector2d<T> top_left, int width, int height, int segments,
-        int pin_mod, T stiffness, ObjectPool<T>* object_pool)
+    // Number of pins Cloth puts on its top row: every pin_mod-th particle and the last one
+    inline int ClothPinCount(int segments, int pin_mod)
+    {
+        int pins = (segments - 1) / pin_mod + 1;
+        return ((segments - 1) % pin_mod == 0) ? pins : pins + 1;
+    }
+
+    template<class T, class... Extra> Composite<T>* Cloth(math::Vector2d<T> top_left, int width, int height, int segments,
+        int pin_mod, T stiffness, ObjectPool<T, Extra...>* object_pool, T compliance = 0)
     {
         int particle_count = segments * segments;
         int distance_constraints_count = 2 * segments * (segments - 1);
-        int pin_constraints_count = (segments / pin_mod) + 1;
+        int pin_constraints_count = ClothPinCount(segments, pin_mod);
 
         if (object_pool->CanAllocate(particle_count, pin_constraints_count, distance_constraints_count, 0, 1))
         {
             Composite<T>* composite = object_pool->AllocateComposites(1);
-            Particle<T>* particles = object_pool->AllocateParticles(particle_count);
+            int first_particle = object_pool->AllocateParticles(particle_count);
             PinConstraint<T>* pin_constraints =  object_pool->AllocatePinConstraints(pin_constraints_count);
             DistanceConstraint<T>* distance_constraints =
                 object_pool->AllocateDistanceConstraints(distance_constraints_count);
@@ -184,8 +200,14 @@ namespace simulation {
             T x_stride = width / segments;
             T y_stride = height / segments;
 
+            const ParticleArrays<T>& particles = object_pool->particles;
             *composite = Composite<T>();
-            Particle<T>* particle = &particles[0];
+            composite->SetParticles(IndexRange(first_particle, particle_count));
+            composite->SetConstraints(PIN_CONSTRAINT,
+                IndexRange(object_pool->Index(pin_constraints), pin_constraints_count));
+            composite->SetConstraints(DISTANCE_CONSTRAINT,
+                IndexRange(object_pool->Index(distance_constraints), distance_constraints_count));
+            int particle = first_particle;
             DistanceConstraint<T>* distance_constraint = &distance_constraints[0];
             PinConstraint<T>* pin_constraint = &pin_constraints[0];
             for (int y = 0; y < segments; ++y)
@@ -196,34 +218,31 @@ namespace simulation {
                     T py = top_left.y + (y * y_stride);
                     math::Vector2d<T> position(px, py);
 
-                    *particle = Particle<T>(position);
-                    composite->AddParticle(particle);
+                    particles.Set(particle, Particle<T>(position));
                     // Add pin if required
                     if (y == 0 && ((x%pin_mod) == 0 || x == segments-1))
                     {
-                        *pin_constraint = PinConstraint<T>(particle, particle->position);
-                        composite->AddConstraint(pin_constraint);
+                        *pin_constraint = PinConstraint<T>(particle, position);
+                        particles.inverse_mass[particle] = 0;
                         pin_constraint++;
                     }
                     particle++;
 
                     if (x > 0)
                     {
-                        int index = (y * segments) + x;
+                        int index = first_particle + (y * segments) + x;
                         // (y*segments + x) and (y*segments + x-1)
-                        *distance_constraint = DistanceConstraint<T>(&particles[index], &particles[index - 1],
-                            stiffness);
-                        composite->AddConstraint(distance_constraint);
+                        *distance_constraint = DistanceConstraint<T>(particles, index, index - 1, stiffness,
+                            compliance);
                         distance_constraint++;
                     }
 
                     if (y > 0)
                     {
-                        int index = (y * segments) + x;
+                        int index = first_particle + (y * segments) + x;
                         // (y*segments + x) and ((y-1)*segments + x)
-                        *distance_constraint = DistanceConstraint<T>(&particles[index], &particles[index - segments],
-                            stiffness);
-                        composite->AddConstraint(distance_constraint);
+                        *distance_constraint = DistanceConstraint<T>(particles, index, index - segments,
+                            stiffness, compliance);
                         distance_constraint++;
                     }
                 }
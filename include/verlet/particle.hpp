@@ -16,23 +16,89 @@ namespace verlet
     public:
         math::Vector2d<T> position;
         math::Vector2d<T> last_position;
+        // particle-particle collision radius, 0 for none
+        T radius;
+        // 1/mass as used by the exact distance projection, 0 for particles that never move
+        T inverse_mass;
 
         Particle()
         {
             this->position = math::Vector2d<T>(0, 0);
             this->last_position = this->position;
+            this->radius = 0;
+            this->inverse_mass = 1;
         }
-        
-        Particle(math::Vector2d<T>& position)
+
+        Particle(const math::Vector2d<T>& position, T radius = 0, T inverse_mass = 1)
         {
             this->position = position;
             this->last_position = position;
+            this->radius = radius;
+            this->inverse_mass = inverse_mass;
+        }
+    };
+
+
+    // Non-owning structure-of-arrays view over the particle storage of an ObjectPool.
+    // Particles are addressed by index; the solver loops over the raw arrays directly.
+    template <class T>
+    class ParticleArrays
+    {
+        static_assert(std::is_floating_point<T>::value,
+                      "ParticleArrays can be of floating point data types only");
+    public:
+        T* x;
+        T* y;
+        T* last_x;
+        T* last_y;
+        T* radius;
+        T* inverse_mass;
+
+        ParticleArrays() : x(nullptr), y(nullptr), last_x(nullptr), last_y(nullptr), radius(nullptr),
+            inverse_mass(nullptr)
+        {
+        }
+
+        math::Vector2d<T> Position(int index) const
+        {
+            return math::Vector2d<T>(x[index], y[index]);
         }
-        
-        Particle(Particle<T>& particle)
+
+        math::Vector2d<T> LastPosition(int index) const
+        {
+            return math::Vector2d<T>(last_x[index], last_y[index]);
+        }
+
+        void SetPosition(int index, const math::Vector2d<T>& position) const
+        {
+            x[index] = position.x;
+            y[index] = position.y;
+        }
+
+        void Translate(int index, const math::Vector2d<T>& offset) const
+        {
+            x[index] += offset.x;
+            y[index] += offset.y;
+        }
+
+        Particle<T> Get(int index) const
+        {
+            Particle<T> particle;
+            particle.position = Position(index);
+            particle.last_position = LastPosition(index);
+            particle.radius = radius[index];
+            particle.inverse_mass = inverse_mass[index];
+            return particle;
+        }
+
+        void Set(int index, const Particle<T>& particle) const
         {
-            this->position = particle.position;
-            this->last_position = particle.last_position;
+            x[index] = particle.position.x;
+            y[index] = particle.position.y;
+            last_x[index] = particle.last_position.x;
+            last_y[index] = particle.last_position.y;
+            radius[index] = particle.radius;
+            inverse_mass[index] = particle.inverse_mass;
         }
     };
 }
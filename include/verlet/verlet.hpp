@@ -2,51 +2,229 @@
 #ifndef ____verlet__
 #define ____verlet__
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <vector>
+
 #include "math/vector2d.hpp"
 #include "verlet/particle.hpp"
 #include "verlet/constraints.hpp"
+#include "verlet/batches.hpp"
+#include "verlet/collision.hpp"
+#include "verlet/islands.hpp"
+#include "verlet/kernels.hpp"
+#include "verlet/worker_pool.hpp"
 #include "simulation/object_pool.hpp"
 
 
 namespace verlet
 {
-    template <class T>
+    // Approximate relaxes distance constraints with the (l^2 - d^2)/d^2 approximation scaled by the step
+    // coefficient, the original behaviour. Exact projects them onto their rest length weighted by inverse
+    // mass, stiffness being the share of the error removed per iteration, and converges in far fewer
+    // iterations. Xpbd ignores stiffness and solves for the compliance of each distance and angular
+    // constraint, so the material stays the same when the iteration count drops; fewer iterations only leave
+    // more residual error.
+    enum class DistanceMode
+    {
+        Approximate,
+        Exact,
+        Xpbd
+    };
+
+    // Extra lists the constraint kinds registered with the object pool on top of the built in ones. Their
+    // constraints are relaxed by a statically dispatched loop per kind, after the angular constraints.
+    template <class T, class... Extra>
     class Verlet
     {
         static_assert(std::is_floating_point<T>::value,
               "Verlet can be of floating point data types only");
 
+        typedef simulation::ObjectPool<T, Extra...> Pool;
+
+        // visitor for ObjectPool::VisitConstraints
+        struct ConnectIslands
+        {
+            Islands<T>& islands;
+
+            template <class Constraint>
+            void operator()(const Constraint* constraints, int count) const
+            {
+                islands.Connect(constraints, count);
+            }
+        };
+
         T _width;
         T _height;
         T _friction;
         T _ground_friction;
+        // in units per second squared
         math::Vector2d<T> _gravity;
 
-        simulation::ObjectPool<T>* _object_pool;
+        // fixed step Update advances by, in seconds, the relaxation iterations per step and the most steps
+        // one Update may take before it drops the rest of the frame time
+        T _time_step;
+        int _iterations;
+        int _max_substeps;
+        // a step stops relaxing once the rms distance residual is within _tolerance after at least
+        // _min_iterations passes, or once relaxing took _max_relax_time seconds; 0 disables either check
+        int _min_iterations;
+        T _tolerance;
+        double _max_relax_time;
+        // passes taken by the last step and the distance violation measured in its last pass
+        int _iterations_used;
+        DistanceResidual<T> _residual;
+        // residual of each chunk of the color being relaxed
+        std::vector<DistanceResidual<T> > _chunk_residuals;
+        // frame time not yet simulated
+        T _accumulator;
+        // duration of the step being taken and of the one before it, for the time corrected integration
+        T _step_time;
+        T _last_step_time;
+
+        Pool* _object_pool;
+
+        DistanceBatches<T> _distance_batches;
+        AngularBatches<T> _angular_batches;
+        int _batches_version;
+        Islands<T> _islands;
+        int _islands_version;
+        kernels::SimdLevel _simd_level;
+        DistanceMode _distance_mode;
+        typename kernels::DistanceKernel<T>::Function _relax_distance;
+        // scalar kernel of the same mode, for the constraints left out of the coloring
+        typename kernels::DistanceKernel<T>::Function _relax_distance_serial;
+        typename kernels::AngularKernel<T>::Function _relax_angular;
+        typename kernels::AngularKernel<T>::Function _relax_angular_serial;
+
+        std::unique_ptr<WorkerPool> _workers;
+
+        ParticleCollisions<T> _collisions;
+        EdgeCollisions<T> _edge_collisions;
+        // composite index of each particle, -1 for particles outside composites
+        std::vector<int> _particle_groups;
+
+        // work split granularity; constraint chunks are a multiple of the widest kernel
+        static const int PARTICLE_GRAIN = 4096;
+        static const int CONSTRAINT_GRAIN = 1024;
+
+        static typename kernels::DistanceKernel<T>::Function SelectDistanceKernel(DistanceMode mode,
+            kernels::SimdLevel level)
+        {
+            switch (mode)
+            {
+                case DistanceMode::Exact:
+                    return kernels::ExactDistanceKernel<T>::Select(level);
+                case DistanceMode::Xpbd:
+                    return kernels::XpbdDistanceKernel<T>::Select(level);
+                default:
+                    return kernels::DistanceKernel<T>::Select(level);
+            }
+        }
+
+        // Only Xpbd changes how angular constraints are relaxed
+        static typename kernels::AngularKernel<T>::Function SelectAngularKernel(DistanceMode mode,
+            kernels::SimdLevel level)
+        {
+            return (mode == DistanceMode::Xpbd) ? kernels::XpbdAngularKernel<T>::Select(level)
+                : kernels::AngularKernel<T>::Select(level);
+        }
+
+        template <class F>
+        void ParallelFor(int count, int grain, const F& function)
+        {
+            if (_workers)
+            {
+                _workers->ParallelFor(count, grain, function);
+            }
+            else if (count > 0)
+            {
+                function(0, count);
+            }
+        }
 
-        void RestrictToBounds(Particle<T>* particle)
+        // Calls function(begin, end) in parallel over every run of awake particles
+        template <class F>
+        void ForEachAwakeRange(const F& function)
         {
-            T x = particle->position.x;
-            T y = particle->position.y;
+            const std::vector<int>& ranges = _islands.awake_ranges;
+            for (size_t r = 0; r < ranges.size(); r += 2)
+            {
+                const int offset = ranges[r];
+                ParallelFor(ranges[r + 1] - offset, PARTICLE_GRAIN, [&](int begin, int end) {
+                    function(offset + begin, offset + end);
+                });
+            }
+        }
 
-            if (particle->position.y > _height-1)
+        void WakeIfTouched(int particle, int other)
+        {
+            const std::vector<int>& particle_island = _islands.particle_island;
+            int island = particle_island[particle];
+            int other_island = particle_island[other];
+            if (_islands.Asleep(island) && !_islands.Asleep(other_island) && _islands.Moving(other_island))
             {
-                y = _height-1;
+                _islands.Wake(_object_pool->particles, island);
             }
-            else if (particle->position.y < 0)
+            else if (_islands.Asleep(other_island) && !_islands.Asleep(island) && _islands.Moving(island))
             {
-                y = 0;
+                _islands.Wake(_object_pool->particles, other_island);
             }
-            
-            if (particle->position.x < 0)
+        }
+
+        void IntegrateRange(int begin, int end)
+        {
+            const ParticleArrays<T>& particles = _object_pool->particles;
+            T* __restrict__ x = particles.x;
+            T* __restrict__ y = particles.y;
+            T* __restrict__ last_x = particles.last_x;
+            T* __restrict__ last_y = particles.last_y;
+
+            // hoisted so the loop below only touches the particle arrays. The last displacement is rescaled by
+            // the ratio of the step times, so a change of step time does not change the velocity.
+            const T inertia = _friction * (_step_time / _last_step_time);
+            const T ground_friction = _ground_friction;
+            const T ground = _height-1;
+            const T gravity_x = _gravity.x * _step_time * _step_time;
+            const T gravity_y = _gravity.y * _step_time * _step_time;
+
+            for (int p = begin; p < end; ++p)
             {
-                x = 0;
+                // calculate velocity
+                T velocity_x = (x[p] - last_x[p]) * inertia;
+                T velocity_y = (y[p] - last_y[p]) * inertia;
+
+                // apply ground_friction, blended in rather than branched on to keep the loop vectorizable
+                T velocity_length_square = (velocity_x * velocity_x) + (velocity_y * velocity_y);
+                T on_ground = (y[p] >= ground) ? T(1) : T(0);
+                on_ground = (velocity_length_square > T(0.000001)) ? on_ground : T(0);
+                T scale = 1 + (on_ground * (ground_friction - 1));
+
+                // save last good state
+                last_x[p] = x[p];
+                last_y[p] = y[p];
+
+                // gravity and inertia
+                x[p] = (x[p] + gravity_x) + (velocity_x * scale);
+                y[p] = (y[p] + gravity_y) + (velocity_y * scale);
             }
-            else if (particle->position.x > _width-1)
+        }
+
+        void RestrictRangeToBounds(int begin, int end)
+        {
+            const ParticleArrays<T>& particles = _object_pool->particles;
+            T* __restrict__ x = particles.x;
+            T* __restrict__ y = particles.y;
+
+            const T max_x = _width-1;
+            const T max_y = _height-1;
+            for (int p = begin; p < end; ++p)
             {
-                x = width-1;
+                x[p] = std::min(std::max(x[p], T(0)), max_x);
+                y[p] = std::min(std::max(y[p], T(0)), max_y);
             }
-            particle->position.Set(x, y);
         }
 
     public:
@@ -55,80 +233,416 @@ namespace verlet
         const T& friction;
         const T& ground_friction;
         const math::Vector2d<T>& gravity;
+        const T& time_step;
+        const int& iterations;
+        const int& max_substeps;
+        const int& min_iterations;
+        const T& tolerance;
+        const double& max_relax_time;
+        const int& iterations_used;
+        const DistanceResidual<T>& residual;
 
-        simulation::ObjectPool<T>* const & object_pool;
-        
-        Verlet(T width, T height, simulation::ObjectPool<T>* object_pool)
+        Pool* const & object_pool;
+        const kernels::SimdLevel& simd_level;
+        const DistanceMode& distance_mode;
+        const ParticleCollisions<T>& collisions;
+        const EdgeCollisions<T>& edge_collisions;
+        const Islands<T>& islands;
+
+        Verlet(T width, T height, Pool* object_pool)
             : _object_pool(nullptr), width(_width), height(_height), friction(_friction),
-            ground_friction(_ground_friction), gravity(_gravity), object_pool(_object_pool)
+            ground_friction(_ground_friction), gravity(_gravity), time_step(_time_step), iterations(_iterations),
+            max_substeps(_max_substeps), min_iterations(_min_iterations), tolerance(_tolerance),
+            max_relax_time(_max_relax_time), iterations_used(_iterations_used), residual(_residual),
+            object_pool(_object_pool), simd_level(_simd_level),
+            distance_mode(_distance_mode), collisions(_collisions), edge_collisions(_edge_collisions),
+            islands(_islands)
         {
             _width = width;
             _height = height;
-            _gravity.Set(-0.2, 0.2);
+            // 0.2 units per step squared at 60 steps per second
+            _gravity.Set(-720, 720);
             _friction = 1;
             _ground_friction = 0.8;
+            _time_step = T(1) / 60;
+            _iterations = 16;
+            _max_substeps = 8;
+            _min_iterations = 1;
+            _tolerance = 0;
+            _max_relax_time = 0;
+            _iterations_used = 0;
+            _accumulator = 0;
+            _step_time = _time_step;
+            _last_step_time = _time_step;
             _object_pool = object_pool;
+            _batches_version = -1;
+            _islands_version = -1;
+            _distance_mode = DistanceMode::Approximate;
+            SetSimdLevel(kernels::DetectSimdLevel());
+        }
+
+        // Picks the distance and angular relaxation kernels. Levels above what the CPU supports fall back to
+        // the best supported one.
+        void SetSimdLevel(kernels::SimdLevel level)
+        {
+            kernels::SimdLevel supported = kernels::DetectSimdLevel();
+            _simd_level = (level > supported) ? supported : level;
+            _relax_distance = SelectDistanceKernel(_distance_mode, _simd_level);
+            _relax_distance_serial = SelectDistanceKernel(_distance_mode, kernels::SimdLevel::Scalar);
+            _relax_angular = SelectAngularKernel(_distance_mode, _simd_level);
+            _relax_angular_serial = SelectAngularKernel(_distance_mode, kernels::SimdLevel::Scalar);
+        }
+
+        void SetDistanceMode(DistanceMode mode)
+        {
+            _distance_mode = mode;
+            SetSimdLevel(_simd_level);
+        }
+
+        // Seconds of simulated time per step taken by Update. Smaller steps are more accurate and cost more
+        // steps per frame.
+        void SetTimeStep(T seconds)
+        {
+            _time_step = seconds;
+        }
+
+        // Relaxation iterations per step. Fewer iterations are cheaper and leave constraints softer, except
+        // for XPBD constraints which only get less accurate.
+        void SetIterations(int iterations)
+        {
+            _iterations = std::max(1, iterations);
+        }
+
+        // Lets a step stop relaxing before its iteration count once at least min_iterations passes ran and the
+        // rms of the distance residual, a share of the rest lengths, is within tolerance. Single constraints
+        // can still be stretched further than that, and scenes whose constraints stay stretched, like a soft
+        // rope hanging from its pin, never get there and keep the full count. Whatever error is left when a
+        // step stops stays in it: in the approximate and exact modes that makes the material softer than the
+        // full iteration count would, in the xpbd mode only less accurate. A tolerance of 0 always runs every
+        // iteration.
+        void SetTolerance(T tolerance, int min_iterations)
+        {
+            _tolerance = tolerance;
+            _min_iterations = std::max(1, min_iterations);
+        }
+
+        // Seconds a step may spend relaxing before it stops with whatever error is left, 0 for no limit
+        void SetMaxRelaxTime(double seconds)
+        {
+            _max_relax_time = seconds;
+        }
+
+        // Steps one Update may take. When frames take longer than that many steps the simulation slows down
+        // instead of falling further and further behind.
+        void SetMaxSubsteps(int substeps)
+        {
+            _max_substeps = std::max(1, substeps);
         }
 
-        void Update(T step)
+        // Fraction of a step of frame time left in the accumulator, to interpolate the drawn positions with
+        T interpolation() const
         {
-            Particle<T>* particle = _object_pool->particles;
-            int particle_count = _object_pool->particle_count;
-            for (int p = 0; p < particle_count; ++p, ++particle)
+            return _accumulator / _time_step;
+        }
+
+        // Runs Update on thread_count threads (including the caller); 1 switches back to a serial step.
+        // Results are the same for any thread count, only the distribution of work changes.
+        void SetThreadCount(int thread_count)
+        {
+            if (thread_count <= 1)
             {
-                // calculate velocity
-                math::Vector2d<T> velocity = (particle->position - particle->last_position) * friction;
+                _workers.reset();
+            }
+            else if (!_workers || _workers->thread_count() != thread_count)
+            {
+                _workers.reset(new WorkerPool(thread_count));
+            }
+        }
+
+        int thread_count() const
+        {
+            return _workers ? _workers->thread_count() : 1;
+        }
+
+        // Islands slower than velocity (in units per step) for Islands::SLEEP_STEPS steps are put to sleep.
+        // 0 disables sleeping and wakes every island.
+        void SetSleepVelocity(T velocity)
+        {
+            _islands.SetSleepVelocity(velocity);
+            if (velocity <= 0 && _batches_version == _object_pool->topology_version)
+            {
+                _islands.WakeAll(_object_pool->particles);
+            }
+        }
+
+        // Wakes the island of a particle. Call after moving a particle or applying a force to it from outside
+        // the solver, sleeping islands otherwise ignore it.
+        void Wake(int particle)
+        {
+            if (_batches_version == _object_pool->topology_version)
+            {
+                _islands.Wake(_object_pool->particles, _islands.particle_island[particle]);
+            }
+        }
+
+        // The phases of Update, public so they can be timed on their own.
+
+        // Rebuilds the islands, constraint batches and collision groups if the pool changed since the last call,
+        // and the batches alone if islands fell asleep or woke up. Starts the XPBD multipliers of the step at 0.
+        void PrepareBatches()
+        {
+            if (_batches_version != _object_pool->topology_version)
+            {
+                _islands.Begin(_object_pool->particle_count);
+                ConnectIslands connect = {_islands};
+                _object_pool->VisitConstraints(connect);
+                _islands.Finish();
 
-                // apply ground_friction
-                if (particle->position.y >= _height-1 && math::EuclideanLengthSquare<T>(velocity) > 0.000001)
+                _particle_groups.assign(_object_pool->particle_count, -1);
+                for (int c = 0; c < _object_pool->composite_count; ++c)
                 {
-                    T m = math::EuclideanLength<T>(velocity);
-                    velocity /= m;
-                    velocity *= (m * ground_friction);
+                    const IndexRange& composite_particles = _object_pool->composites[c].particles();
+                    for (auto it = composite_particles.begin(); it != composite_particles.end(); ++it)
+                    {
+                        _particle_groups[*it] = c;
+                    }
                 }
+                _edge_collisions.Build(_particle_groups.data(), _object_pool->particle_count,
+                    _object_pool->composite_count, _object_pool->distance_constraints,
+                    _object_pool->distance_constraints_count);
+                _batches_version = _object_pool->topology_version;
+            }
 
-                // save last good state
-                particle->last_position = particle->position;
+            _islands.Refresh();
+            if (_islands_version != _islands.version)
+            {
+                // both ends of a constraint share an island, so checking one of them is enough
+                _distance_batches.Build(_object_pool->distance_constraints, _object_pool->distance_constraints_count,
+                    _object_pool->particle_count, [this](const DistanceConstraint<T>& constraint) {
+                        return !_islands.ParticleAsleep(constraint.particle1);
+                    });
+                _angular_batches.Build(_object_pool->angular_constraints, _object_pool->angular_constraints_count,
+                    _object_pool->particle_count, [this](const AngularConstraint<T>& constraint) {
+                        return !_islands.ParticleAsleep(constraint.vertex);
+                    });
+                _islands_version = _islands.version;
+            }
+
+            if (_distance_mode == DistanceMode::Xpbd)
+            {
+                _distance_batches.ResetLambdas();
+                _angular_batches.ResetLambdas();
+            }
+        }
+
+        // Rebuilds the collision grid, refits the composite tree and gathers the contacts of this step
+        void PrepareCollisions()
+        {
+            _collisions.Prepare(_object_pool->particles, _object_pool->particle_count, _particle_groups.data());
+            _edge_collisions.Prepare(_object_pool->particles);
+        }
 
-                // gravity
-                particle->position += gravity;
+        // Moves the particles forward by dt seconds. The velocity comes from the last displacement, corrected for
+        // a dt that differs from the previous one.
+        void Integrate(T dt)
+        {
+            _last_step_time = _step_time;
+            _step_time = dt;
+            ForEachAwakeRange([this](int begin, int end) {
+                IntegrateRange(begin, end);
+            });
+        }
+
+        // Relaxes every awake distance constraint once and measures their violation into _residual
+        void RelaxDistanceConstraints(T stepCoeff)
+        {
+            const ParticleArrays<T>& particles = _object_pool->particles;
+            DistanceBatchView<T> batch = _distance_batches.View();
+            batch.compliance_scale = 1 / (_step_time * _step_time);
+            const std::vector<int>& color_offsets = _distance_batches.color_offsets;
+            _residual = DistanceResidual<T>();
 
-                // inertia
-                particle->position += velocity;
+            int color_count = _distance_batches.color_count();
+            for (int color = 0; color < color_count; ++color)
+            {
+                // constraints of one color are independent, so chunks of a color can run concurrently
+                const int offset = color_offsets[color];
+                const int count = color_offsets[color + 1] - offset;
+                _chunk_residuals.assign((count + CONSTRAINT_GRAIN - 1) / CONSTRAINT_GRAIN, DistanceResidual<T>());
+                ParallelFor(count, CONSTRAINT_GRAIN, [&](int begin, int end) {
+                    // a serial run gets the whole range, it is split the same way so the thread count does not
+                    // change the sums either
+                    for (int chunk = begin; chunk < end; chunk += CONSTRAINT_GRAIN)
+                    {
+                        _relax_distance(particles, batch, offset + chunk,
+                            offset + std::min(chunk + CONSTRAINT_GRAIN, end), stepCoeff,
+                            _chunk_residuals[chunk / CONSTRAINT_GRAIN]);
+                    }
+                });
+                for (size_t chunk = 0; chunk < _chunk_residuals.size(); ++chunk)
+                {
+                    _residual.Merge(_chunk_residuals[chunk]);
+                }
             }
 
-            // relax
-            T stepCoef = 1/step;
-            for (int i = 0; i < step; ++i)
+            // constraints left over by the coloring may share particles, relax them one at a time
+            _relax_distance_serial(particles, batch, _distance_batches.serial_offset,
+                _distance_batches.constraint_count(), stepCoeff, _residual);
+        }
+
+        void RelaxCollisions()
+        {
+            // sleeping particles do not move, whatever touches them takes the whole correction
+            const T* mobility = _islands.mobility.data();
+            _collisions.Relax(_object_pool->particles, mobility);
+            _edge_collisions.Relax(_object_pool->particles, mobility);
+        }
+
+        void RelaxAngularConstraints(T stepCoeff)
+        {
+            const ParticleArrays<T>& particles = _object_pool->particles;
+            AngularBatchView<T> batch = _angular_batches.View();
+            batch.compliance_scale = 1 / (_step_time * _step_time);
+            const std::vector<int>& color_offsets = _angular_batches.color_offsets;
+
+            int color_count = _angular_batches.color_count();
+            for (int color = 0; color < color_count; ++color)
+            {
+                const int offset = color_offsets[color];
+                ParallelFor(color_offsets[color + 1] - offset, CONSTRAINT_GRAIN, [&](int begin, int end) {
+                    _relax_angular(particles, batch, offset + begin, offset + end, stepCoeff);
+                });
+            }
+            _relax_angular_serial(particles, batch, _angular_batches.serial_offset,
+                _angular_batches.constraint_count(), stepCoeff);
+        }
+
+        // Relaxes every constraint of one kind, skipping the ones on sleeping islands
+        template <class Constraint>
+        void RelaxConstraints(T stepCoeff)
+        {
+            const ParticleArrays<T>& particles = _object_pool->particles;
+            Constraint* constraint = _object_pool->template Constraints<Constraint>();
+            int constraint_count = _object_pool->template ConstraintCount<Constraint>();
+            for (int c = 0; c < constraint_count; ++c, ++constraint)
+            {
+                bool asleep = false;
+                constraint->ForEachParticle([&](int particle) {
+                    asleep = asleep || _islands.ParticleAsleep(particle);
+                });
+                if (!asleep)
+                {
+                    constraint->Relax(particles, stepCoeff);
+                }
+            }
+        }
+
+        void RelaxExtraConstraints(T stepCoeff)
+        {
+            int expand[] = {0, (RelaxConstraints<Extra>(stepCoeff), 0)...};
+            (void) expand;
+        }
+
+        void RelaxPinConstraints(T stepCoeff)
+        {
+            const ParticleArrays<T>& particles = _object_pool->particles;
+            PinConstraint<T>* pin_constraint = _object_pool->pin_constraints;
+            int constraint_count = _object_pool->pin_constraints_count;
+            for (int c = 0; c < constraint_count; ++c, ++pin_constraint)
             {
-                DistanceConstraint<T>* distance_constraint = _object_pool->distance_constraints;
-                int constraint_count = _object_pool->distance_constraints_count;
-                for (int c = 0; c < constraint_count; ++c, ++distance_constraint)
+                if (_islands.ParticleAsleep(pin_constraint->particle))
                 {
-                    distance_constraint->Relax(stepCoef);
+                    continue;
                 }
+                pin_constraint->Relax(particles, stepCoeff);
+            }
+        }
+
+        void RestrictToBounds()
+        {
+            ForEachAwakeRange([this](int begin, int end) {
+                RestrictRangeToBounds(begin, end);
+            });
+        }
 
-                AngularConstraint<T>* angular_constraint = _object_pool->angular_constraints;
-                constraint_count = _object_pool->angular_constraints_count;
-                for (int c = 0; c < constraint_count; ++c, ++angular_constraint)
+        // Wakes sleeping islands touched by moving ones, then puts the islands that came to rest to sleep
+        void UpdateIslands()
+        {
+            const ParticleArrays<T>& particles = _object_pool->particles;
+            _islands.Measure(particles);
+            if (_islands.sleeping_count > 0)
+            {
+                const std::vector<int>& pairs = _collisions.pairs;
+                for (size_t i = 0; i < pairs.size(); i += 2)
+                {
+                    WakeIfTouched(pairs[i], pairs[i + 1]);
+                }
+                const std::vector<int>& contacts = _edge_collisions.contacts;
+                for (size_t i = 0; i < contacts.size(); i += 3)
                 {
-                    angular_constraint->Relax(stepCoef);
+                    WakeIfTouched(contacts[i], contacts[i + 1]);
                 }
+            }
+            _islands.Sleep(particles);
+        }
+
+        // One step of dt seconds with at most the configured iteration count
+        void Step(T dt)
+        {
+            typedef std::chrono::steady_clock Clock;
+
+            PrepareBatches();
+            Integrate(dt);
+            PrepareCollisions();
 
-                PinConstraint<T>* pin_constraint = _object_pool->pin_constraints;
-                constraint_count = _object_pool->pin_constraints_count;
-                for (int c = 0; c < constraint_count; ++c, ++pin_constraint)
+            // relax
+            Clock::time_point relax_start = Clock::now();
+            T stepCoef = T(1) / _iterations;
+            _iterations_used = 0;
+            while (_iterations_used < _iterations)
+            {
+                RelaxDistanceConstraints(stepCoef);
+                RelaxAngularConstraints(stepCoef);
+                RelaxExtraConstraints(stepCoef);
+                RelaxCollisions();
+                RelaxPinConstraints(stepCoef);
+                ++_iterations_used;
+
+                // each constraint is measured before it is corrected, so this is what the pass started from
+                if (_tolerance > 0 && _iterations_used >= _min_iterations && _residual.rms() <= _tolerance)
+                {
+                    break;
+                }
+                if (_max_relax_time > 0
+                    && std::chrono::duration<double>(Clock::now() - relax_start).count() >= _max_relax_time)
                 {
-                    pin_constraint->Relax(stepCoef);
+                    break;
                 }
             }
 
             // restrict to bounds
-            particle = _object_pool->particles;
-            for (int p = 0; p < particle_count; ++p, ++particle)
+            RestrictToBounds();
+            UpdateIslands();
+        }
+
+        // Advances the simulation by frame_time seconds in fixed steps of time_step, carrying the remainder
+        // over to the next call. Returns the number of steps taken.
+        int Update(T frame_time)
+        {
+            _accumulator += frame_time;
+            int substeps = 0;
+            while (_accumulator >= _time_step && substeps < _max_substeps)
+            {
+                Step(_time_step);
+                _accumulator -= _time_step;
+                ++substeps;
+            }
+            if (substeps == _max_substeps)
             {
-                RestrictToBounds(particle);
+                // keep the fraction of a step, drop the steps there was no time for
+                _accumulator = std::fmod(_accumulator, _time_step);
             }
+            return substeps;
         }
     };
 }
@@ -0,0 +1,184 @@
+
+#ifndef ____worker_pool__
+#define ____worker_pool__
+
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace verlet
+{
+    // Persistent pool of solver threads. ParallelFor splits a range into fixed chunks, hands each worker
+    // an equal share of them up front, and lets workers that run dry steal the remaining chunks of the
+    // others. The calling thread takes part as worker 0 and ParallelFor only returns once every chunk is
+    // done, so consecutive calls are separated by a barrier.
+    //
+    // Chunk boundaries only depend on the range and the grain, never on which thread runs a chunk, so
+    // jobs whose chunks write disjoint data produce the same result on every run.
+    class WorkerPool
+    {
+        typedef void (*Job)(const void* context, int begin, int end);
+
+        // one per worker, padded so stealing does not bounce the owner's cache line
+        struct Queue
+        {
+            std::atomic<int> next;
+            int end;
+            char padding[64 - sizeof(std::atomic<int>) - sizeof(int)];
+        };
+
+        static const int SPINS_BEFORE_SLEEP = 4096;
+
+        int _thread_count;
+        std::vector<std::thread> _threads;
+        Queue* _queues;
+
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        std::atomic<int> _generation;
+        std::atomic<int> _remaining;
+        bool _stop;
+
+        Job _job;
+        const void* _context;
+        int _count;
+        int _grain;
+
+        template <class F>
+        static void Invoke(const void* context, int begin, int end)
+        {
+            (*static_cast<const F*>(context))(begin, end);
+        }
+
+        void RunChunks(int worker)
+        {
+            for (int offset = 0; offset < _thread_count; ++offset)
+            {
+                // own queue first, then steal from the others in a fixed order
+                Queue& queue = _queues[(worker + offset) % _thread_count];
+                for (;;)
+                {
+                    int chunk = queue.next.fetch_add(1, std::memory_order_relaxed);
+                    if (chunk >= queue.end)
+                    {
+                        break;
+                    }
+                    int begin = chunk * _grain;
+                    int end = (begin + _grain < _count) ? begin + _grain : _count;
+                    _job(_context, begin, end);
+                }
+            }
+        }
+
+        void WorkerLoop(int worker)
+        {
+            int seen = 0;
+            for (;;)
+            {
+                int spins = 0;
+                while (_generation.load(std::memory_order_acquire) == seen)
+                {
+                    if (++spins < SPINS_BEFORE_SLEEP)
+                    {
+                        continue;
+                    }
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _wake.wait(lock, [&]() { return _generation.load(std::memory_order_acquire) != seen; });
+                }
+                seen = _generation.load(std::memory_order_acquire);
+                if (_stop)
+                {
+                    return;
+                }
+
+                RunChunks(worker);
+                _remaining.fetch_sub(1, std::memory_order_acq_rel);
+            }
+        }
+
+        void Run(int count, int grain, Job job, const void* context)
+        {
+            int chunk_count = (count + grain - 1) / grain;
+            for (int w = 0; w < _thread_count; ++w)
+            {
+                _queues[w].next.store((chunk_count * w) / _thread_count, std::memory_order_relaxed);
+                _queues[w].end = (chunk_count * (w + 1)) / _thread_count;
+            }
+            _job = job;
+            _context = context;
+            _count = count;
+            _grain = grain;
+            _remaining.store(_thread_count - 1, std::memory_order_relaxed);
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _generation.fetch_add(1, std::memory_order_release);
+            }
+            _wake.notify_all();
+
+            RunChunks(0);
+            while (_remaining.load(std::memory_order_acquire) != 0)
+            {
+                std::this_thread::yield();
+            }
+        }
+
+    public:
+        // thread_count includes the calling thread
+        explicit WorkerPool(int thread_count)
+            : _thread_count(thread_count < 1 ? 1 : thread_count), _generation(0), _remaining(0), _stop(false),
+            _job(nullptr), _context(nullptr), _count(0), _grain(1)
+        {
+            _queues = new Queue[_thread_count];
+            for (int w = 1; w < _thread_count; ++w)
+            {
+                _threads.push_back(std::thread(&WorkerPool::WorkerLoop, this, w));
+            }
+        }
+
+        ~WorkerPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stop = true;
+                _generation.fetch_add(1, std::memory_order_release);
+            }
+            _wake.notify_all();
+            for (auto it = _threads.begin(); it != _threads.end(); ++it)
+            {
+                it->join();
+            }
+            delete [] _queues;
+        }
+
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool& operator=(const WorkerPool&) = delete;
+
+        int thread_count() const
+        {
+            return _thread_count;
+        }
+
+        // Calls function(begin, end) over [0, count) in chunks of grain elements. Small ranges run inline.
+        template <class F>
+        void ParallelFor(int count, int grain, const F& function)
+        {
+            if (count <= 0)
+            {
+                return;
+            }
+            if (_thread_count == 1 || count <= grain)
+            {
+                function(0, count);
+                return;
+            }
+            Run(count, grain, &Invoke<F>, &function);
+        }
+    };
+}
+
+
+#endif /* defined(____worker_pool__) */
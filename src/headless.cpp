@@ -0,0 +1,89 @@
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+#include "simulation/world.hpp"
+
+// recorded positions are within half a quantum of the simulated ones
+#define TRAJECTORY_QUANTUM 0.001f
+#define TRAJECTORY_KEYFRAME_INTERVAL 60
+
+// Steps the demo world as fast as possible, without a window, vsync or SDL.
+// A tolerance above 0 lets each step stop relaxing once the rms distance residual, a share of the rest lengths,
+// is within it, see Verlet::SetTolerance.
+// With a snapshot path the scene is loaded from it if it exists, and saved to it after the last step. With a
+// trajectory path every step is recorded to it. With a scene path the scene file is loaded in place of the
+// demo scene.
+// usage: verlet-headless [steps] [threads] [tolerance] [snapshot] [trajectory] [scene]
+int main(int argc, char* argv[])
+{
+    int steps = (argc > 1) ? atoi(argv[1]) : 1000;
+    int threads = (argc > 2) ? atoi(argv[2]) : 1;
+    float tolerance = (argc > 3) ? (float) atof(argv[3]) : 0;
+    const char* snapshot = (argc > 4 && argv[4][0] != '\0') ? argv[4] : nullptr;
+    const char* trajectory = (argc > 5 && argv[5][0] != '\0') ? argv[5] : nullptr;
+    const char* scene = (argc > 6 && argv[6][0] != '\0') ? argv[6] : nullptr;
+    if (steps <= 0)
+    {
+        std::cout << "usage: verlet-headless [steps] [threads] [tolerance] [snapshot] [trajectory] [scene]"
+            << std::endl << "steps has to be at least 1" << std::endl;
+        return 1;
+    }
+
+    simulation::World world;
+    auto load_start = std::chrono::steady_clock::now();
+    if (snapshot != nullptr && world.LoadSnapshot(snapshot))
+    {
+        std::chrono::duration<double> load_time = std::chrono::steady_clock::now() - load_start;
+        std::cout << "loaded " << snapshot << " in " << load_time.count() << " s" << std::endl;
+    }
+    else if (scene != nullptr)
+    {
+        if (!world.LoadScene(scene))
+        {
+            std::cout << "LoadScene Error: cannot load " << scene << std::endl;
+            return 1;
+        }
+        std::chrono::duration<double> load_time = std::chrono::steady_clock::now() - load_start;
+        std::cout << "loaded " << scene << " in " << load_time.count() << " s" << std::endl;
+    }
+    else if (!world.CreateDemoScene())
+    {
+        std::cout << "CreateDemoScene Error: object pool is too small for the scene" << std::endl;
+        return 1;
+    }
+    world.solver().SetThreadCount(threads);
+    world.solver().SetTolerance(tolerance, 1);
+    if (trajectory != nullptr && !world.StartRecording(trajectory, TRAJECTORY_QUANTUM, TRAJECTORY_KEYFRAME_INTERVAL))
+    {
+        std::cout << "StartRecording Error: cannot write " << trajectory << std::endl;
+        return 1;
+    }
+
+    long iterations = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps; ++i)
+    {
+        world.Update(world.solver().time_step);
+        iterations += world.solver().iterations_used;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << steps << " steps in " << elapsed.count() << " s ("
+        << (steps / elapsed.count()) << " steps/s, " << world.pool().particle_count << " particles)" << std::endl;
+    std::cout << ((double) iterations / steps) << " iterations per step, residual max "
+        << world.solver().residual.max << " rms " << world.solver().residual.rms() << std::endl;
+
+    if (trajectory != nullptr && !world.StopRecording())
+    {
+        std::cout << "StopRecording Error: cannot write " << trajectory << std::endl;
+        return 1;
+    }
+    if (snapshot != nullptr && !world.SaveSnapshot(snapshot))
+    {
+        std::cout << "SaveSnapshot Error: cannot write " << snapshot << std::endl;
+        return 1;
+    }
+    return 0;
+}
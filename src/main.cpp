@@ -3,14 +3,16 @@
 
 #include "simulation/simulation.hpp"
 
-int main()
+// verlet-magic [trajectory] [scene], the trajectory file, unless empty, is played back instead of simulating
+// the scene; the scene file replaces the demo scene
+int main(int argc, char* argv[])
 {
-    simulation::Simulation sim;
+    simulation::Simulation sim((argc > 1 && argv[1][0] != '\0') ? argv[1] : nullptr, (argc > 2) ? argv[2] : nullptr);
 
     SDL_Delay(1000);
+    // the simulation steps on its own thread, this one only handles input and draws
     while(sim.HandleInput())
-    {    	
-        sim.Update();
+    {
         sim.Draw();
     }
     
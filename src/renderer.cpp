@@ -0,0 +1,170 @@
+#include "simulation/renderer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// side of the square circle sprite, in texels
+#define SPRITE_SIZE 16
+
+#define PARTICLE_RADIUS 3
+#define PIN_RADIUS 5
+#define LINE_WIDTH 1
+
+namespace simulation
+{
+    namespace
+    {
+        const SDL_Color PARTICLE_COLOR = {0x00, 0xFF, 0x00, 0xFF};
+        const SDL_Color PIN_COLOR = {0xFF, 0x00, 0x00, 0xFF};
+        const SDL_Color LINE_COLOR = {0xFF, 0xFF, 0xFF, 0xFF};
+
+        const SDL_FPoint SPRITE_TEX_COORDS[4] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+        // the centre of the sprite is opaque white, so untextured quads can share its texture
+        const SDL_FPoint SOLID_TEX_COORDS[4] = {{0.5f, 0.5f}, {0.5f, 0.5f}, {0.5f, 0.5f}, {0.5f, 0.5f}};
+    }
+
+    // Private methods
+
+    bool Renderer::CreateSprite()
+    {
+        // white disc whose alpha is the coverage of each texel, so edges stay smooth when scaled down
+        std::vector<Uint32> pixels(SPRITE_SIZE * SPRITE_SIZE);
+        const float radius = SPRITE_SIZE * 0.5f;
+        for (int y = 0; y < SPRITE_SIZE; ++y)
+        {
+            for (int x = 0; x < SPRITE_SIZE; ++x)
+            {
+                float dx = (x + 0.5f) - radius;
+                float dy = (y + 0.5f) - radius;
+                float coverage = std::min(std::max(radius - std::sqrt(dx * dx + dy * dy) + 0.5f, 0.0f), 1.0f);
+                pixels[y * SPRITE_SIZE + x] = ((Uint32) (coverage * 255.0f + 0.5f) << 24) | 0x00FFFFFF;
+            }
+        }
+
+        SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "1");
+        sprite = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, SPRITE_SIZE,
+            SPRITE_SIZE);
+        if (sprite == nullptr)
+        {
+            std::cout << "SDL_CreateTexture Error: " << SDL_GetError() << std::endl;
+            return false;
+        }
+        SDL_UpdateTexture(sprite, nullptr, pixels.data(), SPRITE_SIZE * sizeof(Uint32));
+        SDL_SetTextureBlendMode(sprite, SDL_BLENDMODE_BLEND);
+        return true;
+    }
+
+    inline void Renderer::AddQuad(const SDL_FPoint* corners, const SDL_FPoint* tex_coords, SDL_Color color)
+    {
+        int first = (int) vertices.size();
+        for (int v = 0; v < 4; ++v)
+        {
+            SDL_Vertex vertex;
+            vertex.position = corners[v];
+            vertex.color = color;
+            vertex.tex_coord = tex_coords[v];
+            vertices.push_back(vertex);
+        }
+
+        const int quad_indices[6] = {0, 1, 2, 0, 2, 3};
+        for (int i = 0; i < 6; ++i)
+        {
+            indices.push_back(first + quad_indices[i]);
+        }
+    }
+
+    inline void Renderer::AddCircle(const math::Vector2d<float>& center, float radius, SDL_Color color)
+    {
+        const SDL_FPoint corners[4] = {
+            {center.x - radius, center.y - radius}, {center.x + radius, center.y - radius},
+            {center.x + radius, center.y + radius}, {center.x - radius, center.y + radius}
+        };
+        AddQuad(corners, SPRITE_TEX_COORDS, color);
+    }
+
+    inline void Renderer::AddLine(const math::Vector2d<float>& start, const math::Vector2d<float>& end,
+        float width, SDL_Color color)
+    {
+        // offset both ends by half the width along the normal of the segment
+        math::Vector2d<float> direction = end - start;
+        float length = math::EuclideanLength(direction);
+        math::Vector2d<float> offset(0, 0);
+        if (length > 0)
+        {
+            offset.Set(-direction.y * (width * 0.5f / length), direction.x * (width * 0.5f / length));
+        }
+
+        const SDL_FPoint corners[4] = {
+            {start.x + offset.x, start.y + offset.y}, {end.x + offset.x, end.y + offset.y},
+            {end.x - offset.x, end.y - offset.y}, {start.x - offset.x, start.y - offset.y}
+        };
+        AddQuad(corners, SOLID_TEX_COORDS, color);
+    }
+
+
+    // Public methods
+
+    Renderer::Renderer() : renderer(nullptr), sprite(nullptr)
+    {
+    }
+
+    Renderer::~Renderer()
+    {
+        Destroy();
+    }
+
+    bool Renderer::Initialize(SDL_Renderer* renderer)
+    {
+        this->renderer = renderer;
+        return CreateSprite();
+    }
+
+    void Renderer::Destroy()
+    {
+        if (sprite != nullptr)
+        {
+            SDL_DestroyTexture(sprite);
+            sprite = nullptr;
+        }
+    }
+
+    void Renderer::Draw(const RenderSnapshot& snapshot, float alpha)
+    {
+        int particle_count = snapshot.particle_count();
+        int distance_count = (int) snapshot.distance_particles.size() / 2;
+        int pin_count = (int) snapshot.pin_particles.size();
+
+        // buffers keep their capacity between frames, so steady scenes do not allocate
+        int quad_count = particle_count + distance_count + pin_count;
+        vertices.clear();
+        indices.clear();
+        vertices.reserve(quad_count * 4);
+        indices.reserve(quad_count * 6);
+
+        positions.resize(particle_count);
+        for (int p = 0; p < particle_count; ++p)
+        {
+            positions[p] = snapshot.Position(p, alpha);
+            AddCircle(positions[p], PARTICLE_RADIUS, PARTICLE_COLOR);
+        }
+
+        const int* distance_particles = snapshot.distance_particles.data();
+        for (int c = 0; c < distance_count; ++c)
+        {
+            AddLine(positions[distance_particles[2 * c]], positions[distance_particles[2 * c + 1]], LINE_WIDTH,
+                LINE_COLOR);
+        }
+
+        for (int c = 0; c < pin_count; ++c)
+        {
+            AddCircle(positions[snapshot.pin_particles[c]], PIN_RADIUS, PIN_COLOR);
+        }
+
+        if (!indices.empty())
+        {
+            SDL_RenderGeometry(renderer, sprite, vertices.data(), (int) vertices.size(), indices.data(),
+                (int) indices.size());
+        }
+    }
+}
@@ -1,32 +1,21 @@
 
 #include "simulation/simulation.hpp"
 
+#include <chrono>
 #include <iostream>
+#include <vector>
 
 #include "SDL2/SDL.h"
-#include "SDL2/SDL2_gfxPrimitives.h"
 
 #include "math/vector2d.hpp"
-#include "verlet/particle.hpp"
-#include "verlet/constraints.hpp"
-#include "verlet/composite.hpp"
-#include "verlet/objects.hpp"
-#include "verlet/verlet.hpp"
-
-#define WORLD_WIDTH 1000
-#define WORLD_HEIGHT 700
+#include "simulation/trajectory.hpp"
+#include "simulation/world.hpp"
+
 #define WINDOW_WIDTH 1000
 #define WINDOW_HEIGHT 700
 
-#define MAX_PARTICLES 5000
-#define MAX_PIN_CONSTRAINTS 100
-#define MAX_DISTANCE_CONSTRAINTS 5000
-#define MAX_ANGULAR_CONSTRAINTS 0
-#define MAX_COMPOSITES 50
-
-#define VERLET_PARTICLE_COLOR 0xFF00FF00
-#define VERLET_PIN_COLOR 0xFF0000FF
-#define VERLET_LINE_COLOR 0xFFFFFFFF
+// how far from a particle a click still grabs it, in world units
+#define PICK_DISTANCE 8
 
 namespace simulation
 {
@@ -68,100 +57,156 @@ namespace simulation
             SDL_Quit();
         }
 
+        if (!scene_renderer.Initialize(renderer))
+        {
+            SDL_DestroyRenderer(renderer);
+            SDL_DestroyWindow(window);
+            SDL_Quit();
+            return 1;
+        }
+
         return 0;
     }
 
     void Simulation::DestroySDL()
     {
+        scene_renderer.Destroy();
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
         SDL_Quit();
     }
 
-    inline bool Simulation::CreateLineSegments()
+    void Simulation::RunPhysics()
     {
-        std::vector<math::Vector2d<float> > segment_points = {
-            math::Vector2d<float>(0,0), math::Vector2d<float>(20,0),
-            math::Vector2d<float>(40,0), math::Vector2d<float>(60,0),
-            math::Vector2d<float>(80,0), math::Vector2d<float>(100,0),
-            math::Vector2d<float>(120,0), math::Vector2d<float>(140,0),
-            math::Vector2d<float>(160,0), math::Vector2d<float>(180,0),
-            math::Vector2d<float>(200,0), math::Vector2d<float>(220,0),
-            math::Vector2d<float>(240,0), math::Vector2d<float>(260,0),
-            math::Vector2d<float>(280,0), math::Vector2d<float>(300,0)
-        };
-        std::vector<int> segment_pin_particle_indexes = {0};
-        math::Vector2d<float> segment_position_offset(400, 30);
-        float segment_stiffness = 0.2;
-        
-        Composite<float>* segment = LineSegments<float>(segment_points, segment_pin_particle_indexes,
-            segment_position_offset, segment_stiffness, object_pool);
+        typedef RenderSnapshot::Clock Clock;
+
+        Clock::time_point last_update = Clock::now();
+        // edges of the drag input handled so far, and whether a release waits for the grab to take a step
+        unsigned presses = 0;
+        unsigned releases = 0;
+        bool release_after_step = false;
+        while (running.load(std::memory_order_relaxed))
+        {
+            Clock::time_point now = Clock::now();
+            float frame_time = std::chrono::duration<float>(now - last_update).count();
+            last_update = now;
 
-        return (segment != nullptr);
-    }
+            if (drag_input.Acquire())
+            {
+                const DragInput& input = drag_input.front();
+                bool pressed = (input.presses != presses);
+                bool released = (input.releases != releases);
+                presses = input.presses;
+                releases = input.releases;
+
+                // a new grab replaces the one before, whether it was released or not
+                if (pressed)
+                {
+                    world->Grab(input.press_position, PICK_DISTANCE);
+                    release_after_step = false;
+                }
+                if (input.active)
+                {
+                    world->MoveGrab(input.position);
+                }
+                else if (released && pressed)
+                {
+                    // a click that came and went between two reads still holds what it grabbed for a step
+                    release_after_step = true;
+                }
+                else if (released)
+                {
+                    world->Release();
+                }
+            }
 
-    inline bool Simulation::CreateBoxes()
-    {
-        std::vector<math::Vector2d<float> > box_points = {
-            math::Vector2d<float>(40,0), math::Vector2d<float>(110,0),
-            math::Vector2d<float>(150,75),
-            math::Vector2d<float>(75,150), math::Vector2d<float>(0,75)
-        };
-        std::vector<std::pair<int, int> > constraint_particle_indexes = {
-            {0,1}, {1,2}, {2,3}, {3,4}, {0,4},
-            {0,2}, {0,3}, {1,3}, {1,4}, {2,4}
-        };
-        math::Vector2d<float> box_position_offset(100, 200);
-        float box_stiffness = 1;
-        Composite<float>* box = Polygon<float>(box_points, constraint_particle_indexes, box_position_offset, 
-            box_stiffness, object_pool);
-
-        return (box != nullptr);
+            verlet::Verlet<float>& solver = world->solver();
+            if (world->Update(frame_time) > 0)
+            {
+                if (release_after_step)
+                {
+                    world->Release();
+                    release_after_step = false;
+                }
+                snapshots.back().Capture(world->pool(), solver.time_step, Clock::now());
+                snapshots.Publish();
+            }
+
+            // sleep until the next step is due instead of spinning on an empty accumulator
+            float until_next_step = (1 - solver.interpolation()) * solver.time_step;
+            std::this_thread::sleep_for(std::chrono::duration<float>(until_next_step));
+        }
     }
 
-    inline bool Simulation::CreateTire()
+    void Simulation::RunReplay()
     {
-        math::Vector2d<float> center(500, 200);
-        float tread_stiffness = 1, spoke_stiffness = 1, radius = 100;
-        int segments = 30;
-        Composite<float>* tire = Tire<float>(center, radius, segments, spoke_stiffness, tread_stiffness,
-            object_pool);
+        typedef RenderSnapshot::Clock Clock;
 
-        return (tire != nullptr);
-    }
+        TrajectoryReader reader;
+        if (!reader.Open(replay_path.c_str()) || reader.frame_count() == 0)
+        {
+            std::cout << "Cannot replay " << replay_path << std::endl;
+            return;
+        }
 
-    inline bool Simulation::CreateCloth()
-    {
-        float width = 300, height = 350;
-        int segments = 20;
-        int pin_mod = 5;
-        float stiffness = 0.9;
-        math::Vector2d<float> top_left(700, 50);
+        // the frame before, what the renderer interpolates from
+        std::vector<float> x, y, last_x, last_y;
+        double time = 0;
+        double last_time = 0;
+        double start_time = 0;
+        Clock::time_point start;
+        int frame = 0;
+        while (running.load(std::memory_order_relaxed))
+        {
+            x.swap(last_x);
+            y.swap(last_y);
+            last_time = time;
+            if (!reader.ReadFrame(frame, x, y, time))
+            {
+                return;
+            }
+            if (frame == 0)
+            {
+                start_time = time;
+                start = Clock::now();
+            }
+            if (frame == 0 || last_x.size() != x.size())
+            {
+                last_x = x;
+                last_y = y;
+                last_time = time;
+            }
 
-        Composite<float>* cloth = Cloth<float>(top_left, width, height, segments, pin_mod, stiffness,
-            object_pool);
+            // frames are shown at the pace they were recorded at
+            std::this_thread::sleep_until(start + std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(time - start_time)));
 
-        return (cloth != nullptr);
+            // the topology comes from the scene, the positions from the file; frames that do not match the
+            // scene are drawn as bare particles
+            RenderSnapshot& snapshot = snapshots.back();
+            snapshot.Capture(world->pool(), (float) (time - last_time), Clock::now());
+            if ((int) x.size() != snapshot.particle_count())
+            {
+                snapshot.distance_particles.clear();
+                snapshot.pin_particles.clear();
+            }
+            snapshot.x.assign(x.begin(), x.end());
+            snapshot.y.assign(y.begin(), y.end());
+            snapshot.last_x.assign(last_x.begin(), last_x.end());
+            snapshot.last_y.assign(last_y.begin(), last_y.end());
+            snapshots.Publish();
+
+            // start over at the end, so the window keeps showing the recording
+            frame = (frame + 1) % reader.frame_count();
+        }
     }
 
-    bool Simulation::CreateWorld(int width, int height)
+    inline math::Vector2d<float> Simulation::ScaleFromWorldToRenderer(math::Vector2d<float> position) const
     {
-        object_pool = new ObjectPool<float>(MAX_PARTICLES, MAX_PIN_CONSTRAINTS, MAX_DISTANCE_CONSTRAINTS,
-            MAX_ANGULAR_CONSTRAINTS, MAX_COMPOSITES);
-
-        world_width = width;
-        world_height = height;
-        world_aspect_ratio = width / height;
-        world = new Verlet<float>(width, height, object_pool);
-
-        return CreateLineSegments()
-            && CreateBoxes()
-            && CreateTire()
-            && CreateCloth();
+        return math::Vector2d<float>(position.x, position.y);
     }
 
-
-    inline math::Vector2d<float> Simulation::ScaleFromWorldToRenderer(math::Vector2d<float> position) const
+    inline math::Vector2d<float> Simulation::ScaleFromRendererToWorld(math::Vector2d<float> position) const
     {
         return math::Vector2d<float>(position.x, position.y);
     }
@@ -169,17 +214,30 @@ namespace simulation
 
     // Public methods
 
-    Simulation::Simulation()
+    Simulation::Simulation(const char* replay_path, const char* scene_path)
+        : replay_path((replay_path != nullptr) ? replay_path : "")
     {
         InitializeSDL();
-        if (!CreateWorld(WORLD_WIDTH, WORLD_HEIGHT))
+        world = new World();
+        bool loaded = (scene_path != nullptr) ? world->LoadScene(scene_path) : world->CreateDemoScene();
+        if (!loaded)
         {
+            std::cout << "Cannot load the scene " << ((scene_path != nullptr) ? scene_path : "") << std::endl;
             exit(1);
         }
+
+        // the first frame draws the scene as built, until the simulation thread publishes a step
+        snapshots.back().Capture(world->pool(), 0, RenderSnapshot::Clock::now());
+        snapshots.Publish();
+        running = true;
+        physics_thread = std::thread(this->replay_path.empty() ? &Simulation::RunPhysics : &Simulation::RunReplay,
+            this);
     }
 
     Simulation::~Simulation()
     {
+        running = false;
+        physics_thread.join();
         DestroySDL();
         delete this->world;
     }
@@ -187,14 +245,16 @@ namespace simulation
     bool Simulation::HandleInput()
     {
         SDL_Event event;
+        bool drag_changed = false;
 
-        if (SDL_PollEvent(&event))
+        // drain the whole queue, a burst of events must not lag behind by a frame each
+        while (SDL_PollEvent(&event))
         {
             if (event.type == SDL_QUIT)
             {
                 return false;
             }
-      
+
             if (event.type == SDL_KEYDOWN)
             {
                 SDL_Keycode keyPressed = event.key.keysym.sym;
@@ -204,13 +264,34 @@ namespace simulation
                         return false;
                 }
             }
+            else if (event.type == SDL_MOUSEBUTTONDOWN && event.button.button == SDL_BUTTON_LEFT)
+            {
+                drag.active = true;
+                drag.position = ScaleFromRendererToWorld(math::Vector2d<float>(event.button.x, event.button.y));
+                drag.press_position = drag.position;
+                ++drag.presses;
+                drag_changed = true;
+            }
+            else if (event.type == SDL_MOUSEBUTTONUP && event.button.button == SDL_BUTTON_LEFT)
+            {
+                drag.active = false;
+                ++drag.releases;
+                drag_changed = true;
+            }
+            else if (event.type == SDL_MOUSEMOTION && drag.active)
+            {
+                drag.position = ScaleFromRendererToWorld(math::Vector2d<float>(event.motion.x, event.motion.y));
+                drag_changed = true;
+            }
         }
-        return true;
-    }
 
-    void Simulation::Update()
-    {
-        world->Update(16);
+        // only the last state of the frame reaches the simulation thread, the edge counts carry the rest
+        if (drag_changed)
+        {
+            drag_input.back() = drag;
+            drag_input.Publish();
+        }
+        return true;
     }
 
     void Simulation::Draw()
@@ -218,32 +299,10 @@ namespace simulation
         SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
         SDL_RenderClear(renderer);
 
-        const Particle<float>* particle = object_pool->particles;
-        int particle_count = object_pool->particle_count;
-        for (int p = 0; p < particle_count; ++p, ++particle)
-        {
-            math::Vector2d<float> scaled_position = particle->position;
-            filledCircleColor(renderer, scaled_position.x, scaled_position.y, 3, VERLET_PARTICLE_COLOR);
-        }
-
-        const DistanceConstraint<float>* distance_constraint = object_pool->distance_constraints;
-        int constraint_count = object_pool->distance_constraints_count;
-        for (int c = 0; c < constraint_count; ++c, ++distance_constraint)
-        {
-            math::Vector2d<float> scaled_position1 = distance_constraint->particle1->position;
-            math::Vector2d<float> scaled_position2 = distance_constraint->particle2->position;
-
-            lineColor(renderer, scaled_position1.x, scaled_position1.y, 
-                scaled_position2.x, scaled_position2.y, VERLET_LINE_COLOR);
-        }
-
-        const PinConstraint<float>* pin_constraint = object_pool->pin_constraints;
-        constraint_count = object_pool->pin_constraints_count;
-        for (int c = 0; c < constraint_count; ++c, ++pin_constraint)
-        {
-            math::Vector2d<float> scaled_position = pin_constraint->particle->position;
-            filledCircleColor(renderer, scaled_position.x, scaled_position.y, 5, VERLET_PIN_COLOR);
-        }
+        // never waits for the simulation thread; without a new step the last one is drawn again
+        snapshots.Acquire();
+        const RenderSnapshot& snapshot = snapshots.front();
+        scene_renderer.Draw(snapshot, snapshot.Interpolation(RenderSnapshot::Clock::now()));
         SDL_RenderPresent(renderer);
     }
 }
\ No newline at end of file
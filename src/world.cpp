@@ -0,0 +1,201 @@
+
+#include "simulation/world.hpp"
+
+#include "math/vector2d.hpp"
+#include "verlet/particle.hpp"
+#include "verlet/constraints.hpp"
+#include "verlet/composite.hpp"
+#include "verlet/objects.hpp"
+#include "verlet/verlet.hpp"
+#include "simulation/scene.hpp"
+#include "simulation/snapshot.hpp"
+
+#define WORLD_WIDTH 1000
+#define WORLD_HEIGHT 700
+
+// pool capacities; only address space is reserved for them, memory is committed as the scene grows
+#define MAX_PARTICLES 1000000
+#define MAX_PIN_CONSTRAINTS 100000
+#define MAX_DISTANCE_CONSTRAINTS 4000000
+#define MAX_ANGULAR_CONSTRAINTS 1000000
+#define MAX_COMPOSITES 100000
+
+// rope, polygon, tire and cloth, see simulation/scene.hpp for the format
+static const char DEMO_SCENE[] = R"({
+    "collision_radius": 3,
+    "objects": [
+        {"type": "line_segments", "position": [400, 30], "stiffness": 0.2, "pins": [0],
+            "vertices": [[0, 0], [20, 0], [40, 0], [60, 0], [80, 0], [100, 0], [120, 0], [140, 0], [160, 0],
+                [180, 0], [200, 0], [220, 0], [240, 0], [260, 0], [280, 0], [300, 0]]},
+        {"type": "polygon", "position": [100, 200], "stiffness": 1,
+            "vertices": [[40, 0], [110, 0], [150, 75], [75, 150], [0, 75]],
+            "constraints": [[0, 1], [1, 2], [2, 3], [3, 4], [0, 4], [0, 2], [0, 3], [1, 3], [1, 4], [2, 4]]},
+        {"type": "tire", "origin": [500, 200], "radius": 100, "segments": 30, "spoke_stiffness": 1,
+            "tread_stiffness": 1},
+        {"type": "cloth", "top_left": [700, 50], "width": 300, "height": 350, "segments": 20, "pin_mod": 5,
+            "stiffness": 0.9}
+    ]
+})";
+
+namespace simulation
+{
+    using namespace verlet;
+
+    // Private methods
+
+    ObjectPool<float>* World::NewPool()
+    {
+        return new ObjectPool<float>(MAX_PARTICLES, MAX_PIN_CONSTRAINTS, MAX_DISTANCE_CONSTRAINTS,
+            MAX_ANGULAR_CONSTRAINTS, MAX_COMPOSITES);
+    }
+
+
+    // Public methods
+
+    World::World()
+    {
+        object_pool = NewPool();
+        simulated_time = 0;
+
+        world_width = WORLD_WIDTH;
+        world_height = WORLD_HEIGHT;
+        verlet = new Verlet<float>(world_width, world_height, object_pool);
+        grabbed_particle = -1;
+        pick_grid_stale = true;
+    }
+
+    World::~World()
+    {
+        delete verlet;
+        delete object_pool;
+    }
+
+    bool World::CreateDemoScene()
+    {
+        std::vector<SceneObject<float> > objects;
+        return ParseScene(DEMO_SCENE, sizeof(DEMO_SCENE) - 1, objects) && BuildScene(objects, object_pool);
+    }
+
+    bool World::LoadScene(const char* path)
+    {
+        pick_grid_stale = true;
+        DistanceMode distance_mode = verlet->distance_mode;
+        if (!simulation::LoadScene(path, object_pool, &distance_mode))
+        {
+            return false;
+        }
+        verlet->SetDistanceMode(distance_mode);
+        return true;
+    }
+
+    bool World::SaveSnapshot(const char* path) const
+    {
+        return simulation::SaveSnapshot(*object_pool, path);
+    }
+
+    bool World::LoadSnapshot(const char* path)
+    {
+        SnapshotView<float> snapshot;
+        if (!snapshot.Open(path))
+        {
+            return false;
+        }
+
+        // snapshots only restore into an empty pool
+        ObjectPool<float>* pool = NewPool();
+        if (!RestoreSnapshot(snapshot, *pool))
+        {
+            delete pool;
+            return false;
+        }
+
+        // the solver keeps its settings, everything it derived from the old pool is rebuilt
+        Verlet<float>* solver = new Verlet<float>(world_width, world_height, pool);
+        solver->SetDistanceMode(verlet->distance_mode);
+        solver->SetSimdLevel(verlet->simd_level);
+        solver->SetThreadCount(verlet->thread_count());
+        solver->SetTimeStep(verlet->time_step);
+        solver->SetIterations(verlet->iterations);
+        solver->SetMaxSubsteps(verlet->max_substeps);
+        solver->SetTolerance(verlet->tolerance, verlet->min_iterations);
+        solver->SetMaxRelaxTime(verlet->max_relax_time);
+        solver->SetSleepVelocity(verlet->islands.sleep_velocity);
+        delete verlet;
+        delete object_pool;
+        verlet = solver;
+        object_pool = pool;
+        grabbed_particle = -1;
+        pick_grid_stale = true;
+        return true;
+    }
+
+    bool World::StartRecording(const char* path, float quantum, int keyframe_interval)
+    {
+        return recorder.Open(path, quantum, keyframe_interval);
+    }
+
+    bool World::StopRecording()
+    {
+        return recorder.Close();
+    }
+
+    int World::Update(float frame_time)
+    {
+        // moved without its last position, so the solver sees the drag as velocity, and put back where it is
+        // held after the steps the constraints pulled it away from it
+        const ParticleArrays<float>& particles = object_pool->particles;
+        if (grabbed_particle >= 0)
+        {
+            particles.SetPosition(grabbed_particle, grab_target);
+            verlet->Wake(grabbed_particle);
+        }
+        int steps = verlet->Update(frame_time);
+        if (grabbed_particle >= 0)
+        {
+            particles.SetPosition(grabbed_particle, grab_target);
+        }
+
+        pick_grid_stale = pick_grid_stale || (steps > 0);
+        simulated_time += steps * verlet->time_step;
+        if (steps > 0 && recorder.is_open())
+        {
+            recorder.Record(particles, object_pool->particle_count, simulated_time);
+        }
+        return steps;
+    }
+
+    bool World::Grab(const math::Vector2d<float>& position, float max_distance)
+    {
+        const ParticleArrays<float>& particles = object_pool->particles;
+        const ParticleCollisions<float>& collisions = verlet->collisions;
+        int particle = -1;
+        if (collisions.enabled() && max_distance <= collisions.grid.cell_size()
+            && (int) collisions.grid.sorted.size() == object_pool->particle_count)
+        {
+            particle = collisions.grid.FindNearest(particles, position.x, position.y, max_distance);
+        }
+        else
+        {
+            if (pick_grid_stale || pick_grid.cell_size() != max_distance)
+            {
+                pick_grid.Build(particles, object_pool->particle_count, max_distance);
+                pick_grid_stale = false;
+            }
+            particle = pick_grid.FindNearest(particles, position.x, position.y, max_distance);
+        }
+
+        grabbed_particle = particle;
+        grab_target = position;
+        return (particle >= 0);
+    }
+
+    void World::MoveGrab(const math::Vector2d<float>& position)
+    {
+        grab_target = position;
+    }
+
+    void World::Release()
+    {
+        grabbed_particle = -1;
+    }
+}